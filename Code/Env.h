@@ -10,10 +10,12 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <memory>
 #include <vector>
 #include <functional>
 #include <filesystem>
+#include <ctime>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -31,9 +33,15 @@ using Utf8Char = Utf8String::value_type;
 
 using byte = unsigned char;
 
+class SIM800C;
+
 int MainLoop(const std::vector<PlatformString>&);
+Utf8String PlatformStringToUtf8(const PlatformString&);
+PlatformString Utf8ToPlatformString(const Utf8String&);
 bool CheckExclusiveProcess(const std::filesystem::path&);
 void EnsureCommPort(const PlatformString&);
+void RemoveCommPort(const PlatformString&);
+void PrepareCommDevice(SIM800C&);
 
 #if defined(WINDOWS) || defined(WIN32) || defined(_WIN32)
 
@@ -96,6 +104,12 @@ public:
 };
 
 #define PLATFORMCLOSE _close
+#define PLATFORMWRITE(fd, data, size) _write(fd, data, (unsigned int)(size))
+
+inline bool PlatformLocalTime(std::time_t t, std::tm* tm)
+{
+	return localtime_s(tm, &t) == 0;
+}
 
 #else
 
@@ -153,6 +167,12 @@ Utf8String EnsurePathString(const T& path)
 }
 
 #define PLATFORMCLOSE close
+#define PLATFORMWRITE write
+
+inline bool PlatformLocalTime(std::time_t t, std::tm* tm)
+{
+	return localtime_r(&t, tm) != nullptr;
+}
 
 #endif
 
@@ -0,0 +1,721 @@
+﻿// Author: Martin Wetzko
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "GsmDecoder.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// DO NOT CHANGE ============================================================================================================================================
+constexpr PlatformChar GsmPage0[] = PLATFORMSTR("@£$¥èéùìòÇ\nØø\rÅåΔ_ΦΓΛΩΠΨΣΘΞ\x1bÆæßÉ !\"#¤%&'()*+,-./0123456789:;<=>?¡ABCDEFGHIJKLMNOPQRSTUVWXYZÄÖÑÜ§¿abcdefghijklmnopqrstuvwxyzäöñüà");
+// DO NOT CHANGE ============================================================================================================================================
+constexpr PlatformChar GsmPage1[] = PLATFORMSTR("??????????\n??\r??????^??????\x1b????????????{}?????\\????????????[~]?|????????????????????????????????????€??????????????????????????");
+// DO NOT CHANGE ============================================================================================================================================
+
+static_assert(std::size(GsmPage0) == 129 && std::size(GsmPage1) == 129, "gsm pages must hold 128 characters");
+
+struct GsmUtf8Char
+{
+	Utf8Char Bytes[3];
+	byte Length;
+	byte Next;
+};
+
+// page 0 at 0, the escape page at 128, every entry names the page of the next septet
+constexpr std::array<GsmUtf8Char, 256> GsmUtf8Table = []()
+	{
+		std::array<GsmUtf8Char, 256> table{};
+
+		for (int i = 0; i < 256; i++)
+		{
+			std::uint32_t code = (std::uint32_t)((i < 128) ? GsmPage0[i] : GsmPage1[i - 128]);
+
+			GsmUtf8Char& entry = table[i];
+
+			if (code == 0x1B)
+			{
+				entry.Next = 128;
+			}
+			else if (code < 0x80)
+			{
+				entry.Bytes[0] = (Utf8Char)code;
+				entry.Length = 1;
+			}
+			else if (code < 0x800)
+			{
+				entry.Bytes[0] = (Utf8Char)(0xC0 | (code >> 6));
+				entry.Bytes[1] = (Utf8Char)(0x80 | (code & 0x3F));
+				entry.Length = 2;
+			}
+			else
+			{
+				entry.Bytes[0] = (Utf8Char)(0xE0 | (code >> 12));
+				entry.Bytes[1] = (Utf8Char)(0x80 | ((code >> 6) & 0x3F));
+				entry.Bytes[2] = (Utf8Char)(0x80 | (code & 0x3F));
+				entry.Length = 3;
+			}
+		}
+
+		return table;
+	}();
+
+// up to 7 packed bytes, least significant first
+inline std::uint64_t LoadSeptetGroup(const byte* data, size_t num)
+{
+	std::uint64_t bits = 0;
+
+	for (size_t i = 0; i < num; i++)
+	{
+		bits |= (std::uint64_t)data[i] << (i * 8);
+	}
+
+	return bits;
+}
+
+// 56 packed bits to 8 septets, one per byte
+inline std::uint64_t UnpackSeptetGroup(std::uint64_t bits)
+{
+#if defined(__BMI2__)
+	return _pdep_u64(bits, 0x7F7F7F7F7F7F7F7FULL);
+#else
+	bits = (bits & 0x000000000FFFFFFFULL) | ((bits & 0x00FFFFFFF0000000ULL) << 4);
+	bits = (bits & 0x00003FFF00003FFFULL) | ((bits & 0x0FFFC0000FFFC000ULL) << 2);
+	bits = (bits & 0x007F007F007F007FULL) | ((bits & 0x3F803F803F803F80ULL) << 1);
+	return bits;
+#endif
+}
+
+bool DecodeGsmSeptetData(const byte* it, const byte* end, int chars, int skip, Utf8String* decoded)
+{
+	decoded->clear();
+
+	size_t size = (size_t)(end - it);
+	size_t wanted = (size_t)std::max(chars, 0);
+
+	// septets cut off by the end of the data get dropped
+	size_t count = std::min(wanted, (size * 8) / 7);
+
+	size_t first = (size_t)std::max(skip, 0);
+
+	if (first >= count)
+	{
+		return count == wanted;
+	}
+
+	// every septet takes at most 3 bytes, entries get copied whole and the length decides the advance
+	decoded->resize(count * 3);
+
+	Utf8Char* out = decoded->data();
+
+	int page = 0;
+
+	for (size_t index = 0, offset = 0; index < count; index += 8, offset += 7)
+	{
+		std::uint64_t septets = UnpackSeptetGroup((size - offset >= 7) ? LoadSeptetGroup(it + offset, 7) : LoadSeptetGroup(it + offset, size - offset));
+
+		size_t k = (first > index) ? std::min<size_t>(first - index, 8) : 0;
+		size_t last = std::min<size_t>(count - index, 8);
+
+		for (; k < last; k++)
+		{
+			const GsmUtf8Char& entry = GsmUtf8Table[page | (int)((septets >> (k * 8)) & 0x7F)];
+
+			std::memcpy(out, entry.Bytes, sizeof(entry.Bytes));
+
+			out += entry.Length;
+			page = entry.Next;
+		}
+	}
+
+	decoded->resize((size_t)(out - decoded->data()));
+
+	return count == wanted;
+}
+
+constexpr std::array<byte, 256> HexDigits = []()
+	{
+		std::array<byte, 256> digits;
+
+		// high bit marks an invalid digit
+		digits.fill(0x80);
+
+		for (int i = 0; i < 10; i++)
+		{
+			digits['0' + i] = (byte)i;
+		}
+
+		for (int i = 0; i < 6; i++)
+		{
+			digits['a' + i] = (byte)(10 + i);
+			digits['A' + i] = (byte)(10 + i);
+		}
+
+		return digits;
+	}();
+
+size_t DecodeHexToBinScalar(const Utf8Char* data, size_t num, byte* decoded, byte* invalid)
+{
+	byte bad = 0;
+
+	for (size_t i = 0; i < num; i++)
+	{
+		byte hi = HexDigits[(byte)data[i * 2]];
+		byte lo = HexDigits[(byte)data[i * 2 + 1]];
+
+		bad |= hi | lo;
+
+		decoded[i] = (byte)((hi << 4) | (lo & 0xF));
+	}
+
+	*invalid |= bad;
+
+	return num;
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#define GSM_HEX_SSE2
+
+// 16 hex digits to 16 nibbles, ok is all ones for valid digits
+inline __m128i HexToNibbles(__m128i chars, __m128i* ok)
+{
+	__m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+	__m128i letter = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+
+	__m128i isdigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+	__m128i isletter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+
+	*ok = _mm_and_si128(*ok, _mm_or_si128(isdigit, isletter));
+
+	return _mm_or_si128(_mm_and_si128(isdigit, digit), _mm_andnot_si128(isdigit, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+}
+
+// 16 nibbles to 8 bytes in the low half of each 16 bit lane
+inline __m128i NibblesToBytes(__m128i nibbles)
+{
+	return _mm_or_si128(_mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0xFF)), 4), _mm_srli_epi16(nibbles, 8));
+}
+
+size_t DecodeHexToBinSSE2(const Utf8Char* data, size_t num, byte* decoded, byte* invalid)
+{
+	__m128i ok = _mm_set1_epi8(-1);
+
+	size_t i = 0;
+
+	for (; i + 16 <= num; i += 16)
+	{
+		__m128i a = NibblesToBytes(HexToNibbles(_mm_loadu_si128((const __m128i*)(data + i * 2)), &ok));
+		__m128i b = NibblesToBytes(HexToNibbles(_mm_loadu_si128((const __m128i*)(data + i * 2 + 16)), &ok));
+
+		_mm_storeu_si128((__m128i*)(decoded + i), _mm_packus_epi16(a, b));
+	}
+
+	if (_mm_movemask_epi8(ok) != 0xFFFF)
+	{
+		*invalid |= 0x80;
+	}
+
+	return i + DecodeHexToBinScalar(data + i * 2, num - i, decoded + i, invalid);
+}
+
+#endif
+
+#if (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))) || defined(_M_X64)
+
+#define GSM_HEX_AVX2
+
+#if defined(__GNUC__)
+#define GSM_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define GSM_TARGET_AVX2
+#endif
+
+GSM_TARGET_AVX2 size_t DecodeHexToBinAVX2(const Utf8Char* data, size_t num, byte* decoded, byte* invalid)
+{
+	const __m256i zero = _mm256_set1_epi8('0');
+	const __m256i lower = _mm256_set1_epi8(0x20);
+	const __m256i a = _mm256_set1_epi8('a');
+	const __m256i nine = _mm256_set1_epi8(9);
+	const __m256i five = _mm256_set1_epi8(5);
+	const __m256i ten = _mm256_set1_epi8(10);
+	const __m256i low = _mm256_set1_epi16(0xFF);
+
+	__m256i ok = _mm256_set1_epi8(-1);
+
+	size_t i = 0;
+
+	for (; i + 32 <= num; i += 32)
+	{
+		__m256i out[2];
+
+		for (int k = 0; k < 2; k++)
+		{
+			__m256i chars = _mm256_loadu_si256((const __m256i*)(data + i * 2 + k * 32));
+
+			__m256i digit = _mm256_sub_epi8(chars, zero);
+			__m256i letter = _mm256_sub_epi8(_mm256_or_si256(chars, lower), a);
+
+			__m256i isdigit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, nine), digit);
+			__m256i isletter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, five), letter);
+
+			ok = _mm256_and_si256(ok, _mm256_or_si256(isdigit, isletter));
+
+			__m256i nibbles = _mm256_blendv_epi8(_mm256_add_epi8(letter, ten), digit, isdigit);
+
+			out[k] = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(nibbles, low), 4), _mm256_srli_epi16(nibbles, 8));
+		}
+
+		// packus works per 128 bit lane, restore the order afterwards
+		_mm256_storeu_si256((__m256i*)(decoded + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(out[0], out[1]), 0xD8));
+	}
+
+	if ((unsigned int)_mm256_movemask_epi8(ok) != 0xFFFFFFFF)
+	{
+		*invalid |= 0x80;
+	}
+
+#if defined(GSM_HEX_SSE2)
+	return i + DecodeHexToBinSSE2(data + i * 2, num - i, decoded + i, invalid);
+#else
+	return i + DecodeHexToBinScalar(data + i * 2, num - i, decoded + i, invalid);
+#endif
+}
+
+bool HasAVX2()
+{
+#if defined(__GNUC__)
+	return __builtin_cpu_supports("avx2");
+#else
+	int info[4];
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#endif
+}
+
+#endif
+
+using DecodeHexToBinFunc = size_t(*)(const Utf8Char*, size_t, byte*, byte*);
+
+DecodeHexToBinFunc SelectDecodeHexToBin()
+{
+#if defined(GSM_HEX_AVX2)
+	if (HasAVX2())
+	{
+		return DecodeHexToBinAVX2;
+	}
+#endif
+
+#if defined(GSM_HEX_SSE2)
+	return DecodeHexToBinSSE2;
+#else
+	return DecodeHexToBinScalar;
+#endif
+}
+
+const DecodeHexToBinFunc DecodeHexToBinImpl = SelectDecodeHexToBin();
+
+// decoded may point to data itself, every output byte is written after its input got read
+bool DecodeHexToBin(std::string_view data, std::span<byte> decoded, size_t* num)
+{
+	if ((data.size() % 2) != 0 || data.size() / 2 > decoded.size())
+	{
+		return false;
+	}
+
+	byte invalid = 0;
+
+	*num = DecodeHexToBinImpl(data.data(), data.size() / 2, decoded.data(), &invalid);
+
+	return (invalid & 0x80) == 0;
+}
+
+// one big endian utf-16 unit or surrogate pair to utf-8, unpaired surrogates become U+FFFD, returns the units taken
+inline size_t EncodeUcs2Char(const byte* data, size_t i, size_t num, Utf8Char*& out)
+{
+	std::uint32_t code = ((std::uint32_t)data[i * 2] << 8) | data[i * 2 + 1];
+	size_t taken = 1;
+
+	if (code >= 0xD800 && code < 0xE000)
+	{
+		std::uint32_t low = (i + 1 < num) ? (((std::uint32_t)data[i * 2 + 2] << 8) | data[i * 2 + 3]) : 0;
+
+		if (code < 0xDC00 && low >= 0xDC00 && low < 0xE000)
+		{
+			code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+			taken = 2;
+		}
+		else
+		{
+			code = 0xFFFD;
+		}
+	}
+
+	if (code < 0x80)
+	{
+		*out++ = (Utf8Char)code;
+	}
+	else if (code < 0x800)
+	{
+		*out++ = (Utf8Char)(0xC0 | (code >> 6));
+		*out++ = (Utf8Char)(0x80 | (code & 0x3F));
+	}
+	else if (code < 0x10000)
+	{
+		*out++ = (Utf8Char)(0xE0 | (code >> 12));
+		*out++ = (Utf8Char)(0x80 | ((code >> 6) & 0x3F));
+		*out++ = (Utf8Char)(0x80 | (code & 0x3F));
+	}
+	else
+	{
+		*out++ = (Utf8Char)(0xF0 | (code >> 18));
+		*out++ = (Utf8Char)(0x80 | ((code >> 12) & 0x3F));
+		*out++ = (Utf8Char)(0x80 | ((code >> 6) & 0x3F));
+		*out++ = (Utf8Char)(0x80 | (code & 0x3F));
+	}
+
+	return taken;
+}
+
+// every unit takes at most 3 bytes and a surrogate pair 4, so the output never passes 3 bytes per unit
+bool DecodeUcs2Data(const byte* it, const byte* end, Utf8String* decoded)
+{
+	size_t size = (size_t)(end - it);
+	size_t num = size / 2;
+
+	decoded->resize(num * 3);
+
+	Utf8Char* out = decoded->data();
+
+	size_t i = 0;
+
+#if defined(GSM_HEX_SSE2)
+	// 8 units at once while they stay below U+0800, which covers latin, greek and cyrillic text
+	for (; i + 8 <= num;)
+	{
+		__m128i units = _mm_loadu_si128((const __m128i*)(it + i * 2));
+		units = _mm_or_si128(_mm_slli_epi16(units, 8), _mm_srli_epi16(units, 8));
+
+		__m128i ascii = _mm_cmpeq_epi16(_mm_and_si128(units, _mm_set1_epi16((short)0xFF80)), _mm_setzero_si128());
+
+		if (_mm_movemask_epi8(ascii) == 0xFFFF)
+		{
+			_mm_storel_epi64((__m128i*)out, _mm_packus_epi16(units, units));
+
+			out += 8;
+			i += 8;
+			continue;
+		}
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(units, _mm_set1_epi16((short)0xF800)), _mm_setzero_si128())) == 0xFFFF)
+		{
+			// lead byte low, trail byte high, ascii lanes keep their single byte
+			__m128i lead = _mm_or_si128(_mm_srli_epi16(units, 6), _mm_set1_epi16(0xC0));
+			__m128i trail = _mm_or_si128(_mm_and_si128(units, _mm_set1_epi16(0x3F)), _mm_set1_epi16(0x80));
+			__m128i pairs = _mm_or_si128(lead, _mm_slli_epi16(trail, 8));
+
+			std::uint16_t words[8];
+			_mm_storeu_si128((__m128i*)words, _mm_or_si128(_mm_and_si128(ascii, units), _mm_andnot_si128(ascii, pairs)));
+
+			int mask = _mm_movemask_epi8(ascii);
+
+			for (int k = 0; k < 8; k++)
+			{
+				std::memcpy(out, &words[k], 2);
+				out += 2 - ((mask >> (k * 2)) & 1);
+			}
+
+			i += 8;
+			continue;
+		}
+
+		for (size_t stop = i + 8; i < stop;)
+		{
+			i += EncodeUcs2Char(it, i, num, out);
+		}
+	}
+#endif
+
+	while (i < num)
+	{
+		i += EncodeUcs2Char(it, i, num, out);
+	}
+
+	decoded->resize((size_t)(out - decoded->data()));
+
+	// a dangling odd byte is dropped
+	return (size % 2) == 0;
+}
+
+// two decimal digits from a semi-octet swapped byte, -1 for anything else
+inline int DecodeGsmBcd(byte value)
+{
+	int tens = value & 0xF;
+	int units = value >> 4;
+
+	return tens <= 9 && units <= 9 ? tens * 10 + units : -1;
+}
+
+// the 7 octets of the service centre time stamp, the zone is in quarter hours
+bool ParseGsmDateTime(const byte* it, const byte* end, Utf8String* datetime)
+{
+	if (end - it < 7)
+	{
+		return false;
+	}
+
+	int year = DecodeGsmBcd(it[0]);
+	int month = DecodeGsmBcd(it[1]);
+	int day = DecodeGsmBcd(it[2]);
+	int hour = DecodeGsmBcd(it[3]);
+	int minute = DecodeGsmBcd(it[4]);
+	int second = DecodeGsmBcd(it[5]);
+
+	if (year < 0 || month < 1 || month > 12 || day < 1 || day > 31 || hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 59)
+	{
+		return false;
+	}
+
+	// the sign is bit 3 of the zone, the first digit only has three bits left
+	bool negative = (it[6] & 0x08) != 0;
+	int quarters = DecodeGsmBcd(it[6] & 0xF7);
+
+	if (quarters < 0)
+	{
+		return false;
+	}
+
+	std::tm tx;
+
+	if (!PlatformLocalTime(std::time(nullptr), &tx))
+	{
+		return false;
+	}
+
+	int currentyear = 1900 + tx.tm_year;
+
+	year += (currentyear / 100) * 100;
+
+	if (year > currentyear)
+	{
+		year -= 100;
+	}
+
+	char buff[64];
+
+	std::snprintf(buff, sizeof(buff), "%i-%02i-%02iT%02i:%02i:%02i%c%02i:%02i", year, month, day, hour, minute, second, negative ? '-' : '+', quarters / 4, (quarters % 4) * 15);
+
+	*datetime = buff;
+
+	return true;
+}
+
+#define ENDIFNECESSARY3 if (it == end) return false
+
+// a malformed element ends the header, the text can still be decoded
+void ParseGsmUserDataHeader(const byte* it, const byte* end, GsmConcatInfo* concat)
+{
+	while (end - it >= 2)
+	{
+		int iei = (int)(*it++);
+		int length = (int)(*it++);
+
+		if (end - it < length)
+		{
+			return;
+		}
+
+		if (iei == 0x00 && length == 3)
+		{
+			// 8 bit reference
+			concat->Reference = (int)it[0];
+			concat->Total = (int)it[1];
+			concat->Sequence = (int)it[2];
+		}
+		else if (iei == 0x08 && length == 4)
+		{
+			// 16 bit reference
+			concat->Reference = ((int)it[0] << 8) | (int)it[1];
+			concat->Total = (int)it[2];
+			concat->Sequence = (int)it[3];
+		}
+
+		it += length;
+	}
+}
+
+bool ParseGsmPDU(const Utf8String& pdu, Utf8String* from, Utf8String* datetime, Utf8String* message, GsmConcatInfo* concat)
+{
+	*concat = GsmConcatInfo();
+
+	// SMSC address and SMS-DELIVER together stay well below this
+	byte buffer[256];
+	size_t size;
+
+	if (!DecodeHexToBin(pdu, buffer, &size))
+	{
+		return false;
+	}
+
+	const byte* it = buffer;
+	const byte* end = buffer + size;
+
+	ENDIFNECESSARY3;
+
+	int num = (int)(*it++);
+
+	while (num-- > 0)
+	{
+		ENDIFNECESSARY3;
+
+		it++;
+	}
+
+	ENDIFNECESSARY3;
+
+	int flags = (int)(*it++);
+
+	ENDIFNECESSARY3;
+
+	int senderNum = (int)(*it++);
+
+	ENDIFNECESSARY3;
+
+	it++; // number type
+
+	num = senderNum + (senderNum % 2);
+
+	Utf8String number;
+
+	for (int i = 0; i < num; i += 2, it++)
+	{
+		ENDIFNECESSARY3;
+
+		number.push_back('0' + (Utf8Char)((*it) & 0xF));
+		number.push_back('0' + (Utf8Char)(((*it) >> 4) & 0xF));
+	}
+
+	if ((int)number.size() < senderNum)
+	{
+		return false;
+	}
+
+	// assume from is empty
+	from->append(number.c_str(), senderNum);
+
+	ENDIFNECESSARY3;
+
+	it++; // proto
+
+	ENDIFNECESSARY3;
+
+	int scheme = (int)(*it++);
+
+	ENDIFNECESSARY3;
+
+	if (!ParseGsmDateTime(it, end, datetime))
+	{
+		return false;
+	}
+
+	it += 7;
+
+	// VALIDITY INFO IF PRESENT
+	if (flags & 0x10)
+	{
+		if (flags & 0x08)
+		{
+			num = 7;
+		}
+		else
+		{
+			num = 1;
+		}
+
+		while (num-- > 0)
+		{
+			ENDIFNECESSARY3;
+
+			it++;
+		}
+	}
+
+	ENDIFNECESSARY3;
+
+	int len = (int)(*it++);
+
+	num = 0;
+
+	if (scheme & 0x8)
+	{
+		// UCS-2
+		// HAS USER DATA HEADER
+		if (flags & 0x40)
+		{
+			ENDIFNECESSARY3;
+
+			// LENGTH OF HEADER
+			num = (int)(*it++);
+
+			if (end - it < num)
+			{
+				return false;
+			}
+
+			ParseGsmUserDataHeader(it, it + num, concat);
+
+			it += num;
+
+			// the user data length includes the header
+			len -= num + 1;
+		}
+
+		if (len > 0 && end - it < len)
+		{
+			return false;
+		}
+
+		DecodeUcs2Data(it, it + std::max(len, 0), message);
+	}
+	else if (scheme & 0x4)
+	{
+		// Binary Message
+		return false;
+	}
+	else
+	{
+		// 7 Bit
+		// HAS USER DATA HEADER
+		if (flags & 0x40)
+		{
+			ENDIFNECESSARY3;
+
+			// LENGTH OF HEADER
+			num = (int)(*it);
+
+			if (end - it <= num)
+			{
+				return false;
+			}
+
+			ParseGsmUserDataHeader(it + 1, it + 1 + num, concat);
+
+			// header and its length byte padded to the next septet
+			num = ((num + 1) * 8 + 6) / 7;
+		}
+
+		DecodeGsmSeptetData(it, end, len, num, message);
+	}
+
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,385 @@
+// Author: Martin Wetzko
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "Shared.h"
+#include "Logger.h"
+#include <thread>
+
+std::atomic<LogLevel> MinLogLevel = LogLevel::Info;
+
+// one writer per thread and the logger thread reading, neither side ever waits for the other
+class LogRing
+{
+private:
+	struct Header
+	{
+		std::uint32_t Size;
+		LogLevel Level;
+		std::int64_t Time;
+	};
+
+	std::unique_ptr<byte[]> mData;
+	size_t mMask;
+	alignas(64) std::atomic<size_t> mHead = 0;
+	alignas(64) std::atomic<size_t> mTail = 0;
+
+	void Copy(size_t pos, const void* data, size_t size)
+	{
+		auto offset = pos & mMask;
+		auto first = std::min(size, mMask + 1 - offset);
+
+		std::memcpy(mData.get() + offset, data, first);
+		std::memcpy(mData.get(), (const byte*)data + first, size - first);
+	}
+
+	void Read(size_t pos, void* data, size_t size) const
+	{
+		auto offset = pos & mMask;
+		auto first = std::min(size, mMask + 1 - offset);
+
+		std::memcpy(data, mData.get() + offset, first);
+		std::memcpy((byte*)data + first, mData.get(), size - first);
+	}
+
+public:
+	LogRing(size_t capacity)
+	{
+		capacity = std::bit_ceil(capacity);
+
+		mData = std::make_unique<byte[]>(capacity);
+		mMask = capacity - 1;
+	}
+
+	bool TryPush(LogLevel level, std::chrono::system_clock::time_point time, std::string_view line)
+	{
+		Header header = { (std::uint32_t)line.size(), level, time.time_since_epoch().count() };
+
+		auto head = mHead.load(std::memory_order_relaxed);
+		auto tail = mTail.load(std::memory_order_acquire);
+
+		if (head - tail + sizeof(header) + line.size() > mMask + 1)
+		{
+			return false;
+		}
+
+		this->Copy(head, &header, sizeof(header));
+		this->Copy(head + sizeof(header), line.data(), line.size());
+
+		mHead.store(head + sizeof(header) + line.size(), std::memory_order_release);
+
+		return true;
+	}
+
+	template<typename F>
+	void Drain(F&& func)
+	{
+		auto tail = mTail.load(std::memory_order_relaxed);
+		auto head = mHead.load(std::memory_order_acquire);
+
+		Utf8String line;
+
+		while (tail != head)
+		{
+			Header header;
+			this->Read(tail, &header, sizeof(header));
+
+			line.resize(header.Size);
+			this->Read(tail + sizeof(header), line.data(), header.Size);
+
+			func(header.Level, std::chrono::system_clock::time_point(std::chrono::system_clock::duration(header.Time)), line);
+
+			tail += sizeof(header) + header.Size;
+		}
+
+		mTail.store(tail, std::memory_order_release);
+	}
+
+	bool IsEmpty() const
+	{
+		return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_relaxed);
+	}
+};
+
+const size_t LogRingSize = 64 * 1024;
+const size_t LogFilesKept = 3;
+
+// rings of all threads that ever logged, the thread local reference keeps a ring alive while its thread runs
+std::vector<std::shared_ptr<LogRing>> LogRings;
+std::mutex LogRingsLock;
+
+std::thread LogThread;
+std::atomic<bool> LogRunning = false;
+std::atomic<bool> LogStopping = false;
+std::atomic<bool> LogWriterWaiting = false;
+std::atomic<size_t> LogDropped = 0;
+std::condition_variable LogWakeup;
+std::mutex LogWakeupLock;
+
+// only touched by the logger thread while it runs
+std::filesystem::path LogPath;
+SafeFdPtr LogFile = SafeFdPtr(-1);
+size_t LogFileSize = 0;
+size_t LogMaxSize = 0;
+std::chrono::seconds LogMaxAge{ 0 };
+std::chrono::steady_clock::time_point LogOpened;
+
+// used before the logger thread runs and after it stopped
+std::mutex LogDirectLock;
+
+void FormatLogLine(Utf8String& out, LogLevel level, std::chrono::system_clock::time_point time, std::string_view line)
+{
+	static constexpr const char* Names[] = { "DEBUG", "INFO ", "ERROR" };
+
+	std::tm tm = { 0 };
+	PlatformLocalTime(std::chrono::system_clock::to_time_t(time), &tm);
+
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count() % 1000;
+
+	char prefix[64];
+	auto size = std::strftime(prefix, sizeof(prefix), "%F %T", &tm);
+	size += std::snprintf(prefix + size, sizeof(prefix) - size, ".%03d %s ", (int)ms, Names[(int)level]);
+
+	out.append(prefix, size);
+	out.append(line);
+	out.append("\n");
+}
+
+void WriteLogFd(int fd, const Utf8String& data)
+{
+	size_t written = 0;
+
+	while (written < data.size())
+	{
+		auto num = PLATFORMWRITE(fd, data.data() + written, data.size() - written);
+
+		if (num <= 0)
+		{
+			break;
+		}
+
+		written += num;
+	}
+}
+
+bool OpenLog()
+{
+	LogFile = OpenLogFile(LogPath);
+
+	if (!LogFile)
+	{
+		return false;
+	}
+
+	std::error_code ec;
+	auto size = std::filesystem::file_size(LogPath, ec);
+
+	LogFileSize = ec ? 0 : (size_t)size;
+	LogOpened = std::chrono::steady_clock::now();
+
+	return true;
+}
+
+void RotateLog()
+{
+	LogFile = SafeFdPtr(-1);
+
+	// name.log.2 -> name.log.3, ..., name.log -> name.log.1
+	for (size_t i = LogFilesKept; i > 0; i--)
+	{
+		auto from = i > 1 ? std::filesystem::path(LogPath).concat("." + std::to_string(i - 1)) : LogPath;
+		auto to = std::filesystem::path(LogPath).concat("." + std::to_string(i));
+
+		std::error_code ec;
+		std::filesystem::rename(from, to, ec);
+	}
+
+	OpenLog();
+}
+
+// drains every ring and writes all lines with one call per target
+void FlushLog()
+{
+	Utf8String out;
+	Utf8String err;
+
+	std::vector<std::shared_ptr<LogRing>> rings;
+
+	{
+		const std::lock_guard<std::mutex> lock(LogRingsLock);
+
+		// the thread of a ring nobody else holds is gone, it is dropped once empty
+		std::erase_if(LogRings, [](const std::shared_ptr<LogRing>& ring) { return ring.use_count() == 1 && ring->IsEmpty(); });
+
+		rings = LogRings;
+	}
+
+	for (auto& ring : rings)
+	{
+		ring->Drain([&out, &err](LogLevel level, std::chrono::system_clock::time_point time, std::string_view line)
+			{
+				FormatLogLine(LogFile || level != LogLevel::Error ? out : err, level, time, line);
+			});
+	}
+
+	if (auto dropped = LogDropped.exchange(0))
+	{
+		FormatLogLine(LogFile ? out : err, LogLevel::Error, std::chrono::system_clock::now(), std::to_string(dropped) + " log lines dropped, the writer can not keep up");
+	}
+
+	if (LogFile)
+	{
+		if (out.size() > 0)
+		{
+			WriteLogFd(LogFile, out);
+
+			LogFileSize += out.size();
+		}
+
+		if ((LogMaxSize > 0 && LogFileSize >= LogMaxSize) || (LogMaxAge.count() > 0 && std::chrono::steady_clock::now() - LogOpened >= LogMaxAge))
+		{
+			RotateLog();
+		}
+	}
+	else
+	{
+		WriteLogFd(1, out);
+		WriteLogFd(2, err);
+	}
+}
+
+bool HasPendingLog()
+{
+	const std::lock_guard<std::mutex> lock(LogRingsLock);
+
+	return LogDropped > 0 || std::any_of(LogRings.begin(), LogRings.end(), [](const std::shared_ptr<LogRing>& ring) { return !ring->IsEmpty(); });
+}
+
+void ProcessLog()
+{
+	while (!LogStopping)
+	{
+		FlushLog();
+
+		std::unique_lock<std::mutex> lock(LogWakeupLock);
+
+		LogWriterWaiting = true;
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (!LogStopping && !HasPendingLog())
+		{
+			// the age of the file is checked at least once a second
+			LogWakeup.wait_for(lock, 1s);
+		}
+
+		LogWriterWaiting = false;
+	}
+}
+
+void WakeLogWriter()
+{
+	if (LogWriterWaiting.exchange(false))
+	{
+		const std::lock_guard<std::mutex> lock(LogWakeupLock);
+
+		LogWakeup.notify_one();
+	}
+}
+
+LogRing& GetThreadLogRing()
+{
+	thread_local std::shared_ptr<LogRing> ring;
+
+	if (!ring)
+	{
+		ring = std::make_shared<LogRing>(LogRingSize);
+
+		const std::lock_guard<std::mutex> lock(LogRingsLock);
+
+		LogRings.push_back(ring);
+	}
+
+	return *ring;
+}
+
+void WriteLog(LogLevel level, std::string_view line)
+{
+	auto now = std::chrono::system_clock::now();
+
+	if (!LogRunning.load(std::memory_order_acquire))
+	{
+		Utf8String out;
+		FormatLogLine(out, level, now, line);
+
+		const std::lock_guard<std::mutex> lock(LogDirectLock);
+
+		WriteLogFd(level == LogLevel::Error ? 2 : 1, out);
+
+		return;
+	}
+
+	auto& ring = GetThreadLogRing();
+
+	for (int i = 0; !ring.TryPush(level, now, line); i++)
+	{
+		WakeLogWriter();
+
+		if (i == 100)
+		{
+			LogDropped++;
+			return;
+		}
+
+		std::this_thread::yield();
+	}
+
+	WakeLogWriter();
+}
+
+bool StartLogger(const std::filesystem::path& path, size_t maxSize, std::chrono::seconds maxAge)
+{
+	LogPath = path;
+	LogMaxSize = maxSize;
+	LogMaxAge = maxAge;
+
+	if (!LogPath.empty() && !OpenLog())
+	{
+		return false;
+	}
+
+	LogStopping = false;
+	LogThread = std::thread(ProcessLog);
+	LogRunning = true;
+
+	return true;
+}
+
+void StopLogger()
+{
+	if (!LogThread.joinable())
+	{
+		return;
+	}
+
+	// new lines are written directly from here on
+	LogRunning = false;
+	LogStopping = true;
+
+	{
+		const std::lock_guard<std::mutex> lock(LogWakeupLock);
+
+		LogWakeup.notify_one();
+	}
+
+	LogThread.join();
+
+	FlushLog();
+
+	LogFile = SafeFdPtr(-1);
+}
@@ -0,0 +1,92 @@
+// Author: Martin Wetzko
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "Env.h"
+#include <atomic>
+#include <chrono>
+#include <sstream>
+
+enum class LogLevel : byte
+{
+	Debug,
+	Info,
+	Error
+};
+
+extern std::atomic<LogLevel> MinLogLevel;
+
+// cheap enough to guard every message, nothing is formatted below the level
+inline bool IsLogEnabled(LogLevel level)
+{
+	return level >= MinLogLevel.load(std::memory_order_relaxed);
+}
+
+// lines are queued in a ring of the calling thread and written in batches by one thread,
+// without a file they go to stdout and errors to stderr, the file is rotated by size or age, 0 disables either
+bool StartLogger(const std::filesystem::path&, size_t, std::chrono::seconds);
+
+// writes whatever is queued, lines are written right away again afterwards
+void StopLogger();
+
+void WriteLog(LogLevel, std::string_view);
+
+// appends and creates the file if necessary
+SafeFdPtr OpenLogFile(const std::filesystem::path&);
+
+// lines stay utf-8 from the caller to the file, only platform strings are converted
+inline Utf8String ToLogText(const PlatformString& str)
+{
+	return PlatformStringToUtf8(str);
+}
+
+inline Utf8String ToLogText(const PlatformChar* str)
+{
+	return PlatformStringToUtf8(str);
+}
+
+template<typename T>
+const T& ToLogText(const T& value)
+{
+	return value;
+}
+
+template<typename... Args>
+void ConsoleLog(LogLevel level, Args&&... args)
+{
+	if (!IsLogEnabled(level))
+	{
+		return;
+	}
+
+	std::ostringstream strm;
+
+	(strm << ... << ToLogText(args));
+
+	WriteLog(level, strm.view());
+}
+
+template<typename... Args>
+void ConsoleDebug(Args&&... args)
+{
+	ConsoleLog(LogLevel::Debug, std::forward<Args>(args)...);
+}
+
+template<typename... Args>
+void ConsoleOut(Args&&... args)
+{
+	ConsoleLog(LogLevel::Info, std::forward<Args>(args)...);
+}
+
+template<typename... Args>
+void ConsoleErr(Args&&... args)
+{
+	ConsoleLog(LogLevel::Error, std::forward<Args>(args)...);
+}
@@ -0,0 +1,153 @@
+// Author: Martin Wetzko
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "Shared.h"
+#include "MailSink.h"
+#include "Metrics.h"
+
+MetricCounter& MailSinkAccepted = GetMetrics().Counter("smsrouter_sink_mails_total", "Mails accepted by the local mail sink.");
+MetricCounter& MailSinkRefused = GetMetrics().Counter("smsrouter_sink_refused_total", "Commands the local mail sink refused on purpose.");
+
+MailSinkSession::MailSinkSession(const MailSinkOptions& options)
+{
+	mOptions = options;
+	mRandom.seed(std::random_device()());
+}
+
+bool MailSinkSession::IsFailing()
+{
+	if (mOptions.FailureRate <= 0 || std::uniform_real_distribution<double>(0, 1)(mRandom) >= mOptions.FailureRate)
+	{
+		return false;
+	}
+
+	MailSinkRefused.Increment();
+
+	return true;
+}
+
+Utf8String MailSinkSession::GetGreeting() const
+{
+	return "220 localhost SmsRouterPi sink ESMTP\r\n";
+}
+
+Utf8String MailSinkSession::HandleLine(std::string_view line, bool* startTls, bool* close)
+{
+	*startTls = false;
+	*close = false;
+
+	if (mInData)
+	{
+		if (line != ".")
+		{
+			mDataSize += line.size() + 2;
+			return Utf8String();
+		}
+
+		mInData = false;
+
+		if (this->IsFailing())
+		{
+			return "451 4.3.0 Injected failure\r\n";
+		}
+
+		MailSinkAccepted.Increment();
+
+		return "250 2.0.0 Ok: " + std::to_string(mDataSize) + " bytes dropped\r\n";
+	}
+
+	if (mAuthSteps > 0)
+	{
+		// the credentials are not checked
+		return --mAuthSteps > 0 ? "334 UGFzc3dvcmQ6\r\n" : "235 2.7.0 Authentication successful\r\n";
+	}
+
+	Utf8String verb(line.substr(0, line.find(' ')));
+	std::transform(verb.begin(), verb.end(), verb.begin(), [](char c) { return (char)std::toupper((unsigned char)c); });
+
+	if (verb == "EHLO" || verb == "HELO")
+	{
+		// STARTTLS first, credentials only over tls
+		return mSecure ? "250-localhost\r\n250-8BITMIME\r\n250 AUTH PLAIN LOGIN\r\n" : "250-localhost\r\n250-8BITMIME\r\n250 STARTTLS\r\n";
+	}
+
+	if (verb == "STARTTLS")
+	{
+		if (mSecure)
+		{
+			return "503 5.5.1 Already secure\r\n";
+		}
+
+		mSecure = true;
+		*startTls = true;
+
+		return "220 2.0.0 Ready to start TLS\r\n";
+	}
+
+	if (verb == "AUTH")
+	{
+		if (!mSecure)
+		{
+			return "530 5.7.0 Must issue a STARTTLS command first\r\n";
+		}
+
+		// every login is accepted, the credentials may follow on their own lines
+		std::string_view mechanism = line.substr(std::min(line.size(), verb.size() + 1));
+		size_t space = mechanism.find(' ');
+		bool login = mechanism.substr(0, space) == "LOGIN" || mechanism.substr(0, space) == "login";
+
+		if (space != std::string_view::npos)
+		{
+			mAuthSteps = login ? 1 : 0;
+		}
+		else
+		{
+			mAuthSteps = login ? 2 : 1;
+		}
+
+		if (mAuthSteps == 0)
+		{
+			return "235 2.7.0 Authentication successful\r\n";
+		}
+
+		return mAuthSteps == 2 ? "334 VXNlcm5hbWU6\r\n" : (login ? "334 UGFzc3dvcmQ6\r\n" : "334 \r\n");
+	}
+
+	if (verb == "MAIL" || verb == "RCPT")
+	{
+		return this->IsFailing() ? "451 4.3.0 Injected failure\r\n" : "250 2.1.0 Ok\r\n";
+	}
+
+	if (verb == "DATA")
+	{
+		if (this->IsFailing())
+		{
+			return "451 4.3.0 Injected failure\r\n";
+		}
+
+		mInData = true;
+		mDataSize = 0;
+
+		return "354 End data with <CR><LF>.<CR><LF>\r\n";
+	}
+
+	if (verb == "RSET" || verb == "NOOP")
+	{
+		return "250 2.0.0 Ok\r\n";
+	}
+
+	if (verb == "QUIT")
+	{
+		*close = true;
+
+		return "221 2.0.0 Bye\r\n";
+	}
+
+	return "502 5.5.2 Command not implemented\r\n";
+}
@@ -0,0 +1,49 @@
+// Author: Martin Wetzko
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "Env.h"
+#include <chrono>
+#include <random>
+
+struct MailSinkOptions
+{
+	// waited before every reply
+	std::chrono::milliseconds Latency{ 0 };
+
+	// share of MAIL, RCPT, DATA and the end of data refused with a temporary error
+	double FailureRate = 0;
+};
+
+// one smtp session of the local sink, takes the client lines and answers them, every mail is thrown away
+class MailSinkSession
+{
+private:
+	MailSinkOptions mOptions;
+	std::mt19937 mRandom;
+	bool mSecure = false;
+	bool mInData = false;
+	int mAuthSteps = 0;
+	size_t mDataSize = 0;
+
+	bool IsFailing();
+
+public:
+	MailSinkSession(const MailSinkOptions&);
+
+	Utf8String GetGreeting() const;
+
+	// the reply with its line breaks, empty while reading the mail, the connection switches to tls after a STARTTLS reply
+	Utf8String HandleLine(std::string_view, bool* startTls, bool* close);
+};
+
+// accepts mails on the loopback address with a self-signed certificate until stopped, false if not available
+bool StartMailSink(std::uint16_t, const MailSinkOptions&, Utf8String* certificate);
+void StopMailSink();
@@ -0,0 +1,573 @@
+// Author: Martin Wetzko
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "MailSpool.h"
+#include "Logger.h"
+
+namespace
+{
+	constexpr std::uint32_t SegmentMagic = 0x4C505353; // "SSPL"
+	constexpr std::uint32_t SegmentVersion = 1;
+	constexpr std::uint32_t RecordMagic = 0x44525353; // "SSRD"
+	constexpr std::uint32_t RecordAdd = 1;
+	constexpr std::uint32_t RecordRelease = 2;
+
+	// records start behind the header, aligned like all records
+	constexpr size_t SegmentHeaderSize = 64;
+	constexpr size_t MaxFreeSegments = 2;
+
+	struct SegmentHeader
+	{
+		std::uint32_t Magic;
+		std::uint32_t Version;
+		std::uint64_t Sequence;
+	};
+
+	// the crc covers everything behind its own field and the payload
+	struct RecordHeader
+	{
+		std::uint32_t Magic;
+		std::uint32_t Crc;
+		std::uint64_t Sequence;
+		std::uint64_t Id;
+		std::uint32_t Type;
+		std::uint32_t Length;
+	};
+
+	static_assert(sizeof(SegmentHeader) <= SegmentHeaderSize);
+	static_assert(sizeof(RecordHeader) == 32);
+
+	constexpr auto CrcTable = []()
+	{
+		std::array<std::uint32_t, 256> table = {};
+
+		for (std::uint32_t i = 0; i < 256; i++)
+		{
+			std::uint32_t c = i;
+
+			for (int k = 0; k < 8; k++)
+			{
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			}
+
+			table[i] = c;
+		}
+
+		return table;
+	}();
+
+	std::uint32_t Crc32(std::uint32_t crc, const byte* it, const byte* end)
+	{
+		crc = ~crc;
+
+		for (; it != end; it++)
+		{
+			crc = CrcTable[(crc ^ *it) & 0xFF] ^ (crc >> 8);
+		}
+
+		return ~crc;
+	}
+
+	std::uint32_t RecordCrc(const RecordHeader& header, const byte* payload)
+	{
+		auto begin = (const byte*)&header + offsetof(RecordHeader, Sequence);
+
+		return Crc32(Crc32(0, begin, begin + sizeof(RecordHeader) - offsetof(RecordHeader, Sequence)), payload, payload + header.Length);
+	}
+
+	size_t RecordSize(size_t length)
+	{
+		return (sizeof(RecordHeader) + length + 7) & ~(size_t)7;
+	}
+
+	void PutField(std::vector<byte>& payload, const Utf8String& value)
+	{
+		std::uint32_t len = (std::uint32_t)value.size();
+
+		payload.insert(payload.end(), (const byte*)&len, (const byte*)&len + sizeof(len));
+		payload.insert(payload.end(), value.begin(), value.end());
+	}
+
+	bool GetField(const byte*& it, const byte* end, Utf8String* value)
+	{
+		std::uint32_t len;
+
+		if (end - it < (ptrdiff_t)sizeof(len))
+		{
+			return false;
+		}
+
+		std::memcpy(&len, it, sizeof(len));
+		it += sizeof(len);
+
+		if ((size_t)(end - it) < len)
+		{
+			return false;
+		}
+
+		if (value)
+		{
+			value->assign((const Utf8Char*)it, len);
+		}
+
+		it += len;
+
+		return true;
+	}
+}
+
+MailSpool::MailSpool(size_t segmentSize)
+{
+	mSegmentSize = std::max<size_t>((segmentSize + 7) & ~(size_t)7, 64 * 1024);
+	mNextId = 1;
+	mNextSequence = 1;
+	mNextFile = 0;
+	mAppended = 0;
+	mCommitted = 0;
+	mSyncing = false;
+}
+
+bool MailSpool::Open(const std::filesystem::path& directory, std::vector<Pending>* pending)
+{
+	const std::lock_guard<std::mutex> lock(mLock);
+
+	mDirectory = directory;
+
+	std::error_code ec;
+	std::filesystem::create_directories(mDirectory, ec);
+
+	std::vector<std::shared_ptr<Segment>> found;
+
+	for (auto& entry : std::filesystem::directory_iterator(mDirectory, ec))
+	{
+		auto name = entry.path().filename().string();
+
+		if (!entry.is_regular_file() || !name.starts_with("segment-") || !name.ends_with(".log"))
+		{
+			continue;
+		}
+
+		mNextFile = std::max<std::uint64_t>(mNextFile, std::strtoull(name.c_str() + 8, nullptr, 10) + 1);
+
+		auto file = OpenMappedFile(entry.path(), mSegmentSize);
+
+		if (!file)
+		{
+			ConsoleErr(PLATFORMSTR("Unable to map spool segment "), entry.path().native());
+			continue;
+		}
+
+		SegmentHeader header = { 0 };
+		std::memcpy(&header, file->GetData(), sizeof(header));
+
+		bool valid = header.Magic == SegmentMagic && header.Version == SegmentVersion && file->GetSize() > SegmentHeaderSize;
+
+		found.push_back(std::make_shared<Segment>(Segment{ entry.path(), file, valid ? header.Sequence : 0, SegmentHeaderSize, SegmentHeaderSize, 0, 0 }));
+	}
+
+	if (ec)
+	{
+		ConsoleErr(PLATFORMSTR("Unable to read the spool directory "), mDirectory.native());
+		return false;
+	}
+
+	std::sort(found.begin(), found.end(), [](const auto& a, const auto& b) { return a->Sequence < b->Sequence; });
+
+	for (auto& segment : found)
+	{
+		if (segment->Sequence == 0)
+		{
+			mFree.push_back(segment);
+			continue;
+		}
+
+		auto data = segment->File->GetData();
+		auto size = segment->File->GetSize();
+		size_t offset = SegmentHeaderSize;
+
+		// stops at the first torn record or at what is left from an older use of the segment
+		while (offset + sizeof(RecordHeader) <= size)
+		{
+			RecordHeader header;
+			std::memcpy(&header, data + offset, sizeof(header));
+
+			if (header.Magic != RecordMagic || header.Sequence != segment->Sequence || header.Length > size - offset - sizeof(RecordHeader))
+			{
+				break;
+			}
+
+			if (header.Crc != RecordCrc(header, data + offset + sizeof(RecordHeader)))
+			{
+				break;
+			}
+
+			if (header.Type == RecordAdd)
+			{
+				mIndex[header.Id] = { segment, offset };
+				segment->Live++;
+			}
+			else if (header.Type == RecordRelease)
+			{
+				auto it = mIndex.find(header.Id);
+
+				if (it != mIndex.end())
+				{
+					it->second.Owner->Live--;
+					mIndex.erase(it);
+				}
+			}
+
+			mNextId = std::max(mNextId, header.Id + 1);
+
+			offset += RecordSize(header.Length);
+		}
+
+		segment->Written = segment->Flushed = offset;
+
+		mNextSequence = segment->Sequence + 1;
+		mSegments.push_back(segment);
+	}
+
+	this->Recycle();
+
+	if (mSegments.empty() && !this->Rotate())
+	{
+		return false;
+	}
+
+	std::vector<std::uint64_t> ids;
+
+	for (auto& [id, location] : mIndex)
+	{
+		ids.push_back(id);
+	}
+
+	std::sort(ids.begin(), ids.end());
+
+	for (auto id : ids)
+	{
+		Pending entry = { id };
+
+		if (this->Read(mIndex[id], id, &entry.Subject, nullptr, &entry.Key))
+		{
+			pending->push_back(entry);
+		}
+	}
+
+	return true;
+}
+
+// needs mLock
+bool MailSpool::Write(std::uint32_t type, std::uint64_t id, std::span<const byte> payload, Location* location)
+{
+	size_t size = RecordSize(payload.size());
+
+	if (size > mSegmentSize - SegmentHeaderSize)
+	{
+		return false;
+	}
+
+	auto segment = mSegments.back();
+
+	if (segment->Written + size > segment->File->GetSize())
+	{
+		if (!this->Rotate())
+		{
+			return false;
+		}
+
+		segment = mSegments.back();
+	}
+
+	RecordHeader header = { RecordMagic, 0, segment->Sequence, id, type, (std::uint32_t)payload.size() };
+	header.Crc = RecordCrc(header, payload.data());
+
+	auto data = segment->File->GetData() + segment->Written;
+
+	std::memcpy(data, &header, sizeof(header));
+	std::memcpy(data + sizeof(header), payload.data(), payload.size());
+
+	if (location)
+	{
+		*location = { segment, segment->Written };
+	}
+
+	segment->Written += size;
+
+	mAppended++;
+
+	return true;
+}
+
+// needs mLock
+bool MailSpool::Read(const Location& location, std::uint64_t id, Utf8String* subject, Utf8String* message, PlatformString* key)
+{
+	auto data = location.Owner->File->GetData() + location.Offset;
+
+	RecordHeader header;
+	std::memcpy(&header, data, sizeof(header));
+
+	if (header.Id != id || header.Type != RecordAdd || header.Crc != RecordCrc(header, data + sizeof(header)))
+	{
+		return false;
+	}
+
+	const byte* it = data + sizeof(header);
+	const byte* end = it + header.Length;
+
+	Utf8String utf8key;
+
+	if (!GetField(it, end, subject) || !GetField(it, end, message) || !GetField(it, end, &utf8key))
+	{
+		return false;
+	}
+
+	if (key)
+	{
+		*key = Utf8ToPlatformString(utf8key);
+	}
+
+	return true;
+}
+
+// needs mLock
+bool MailSpool::Rotate()
+{
+	std::shared_ptr<Segment> segment;
+
+	if (!mFree.empty())
+	{
+		segment = mFree.back();
+		mFree.pop_back();
+	}
+	else
+	{
+		auto path = mDirectory / ("segment-" + std::to_string(mNextFile++) + ".log");
+
+		segment = std::make_shared<Segment>(Segment{ path, OpenMappedFile(path, mSegmentSize), 0, 0, 0, 0, 0 });
+
+		if (!segment->File)
+		{
+			ConsoleErr(PLATFORMSTR("Unable to create spool segment "), path.native());
+			return false;
+		}
+	}
+
+	SegmentHeader header = { SegmentMagic, SegmentVersion, mNextSequence };
+
+	std::memcpy(segment->File->GetData(), &header, sizeof(header));
+
+	// records of the old sequence left in there no longer replay once the header is on the disk
+	if (!segment->File->Flush(0, sizeof(header)))
+	{
+		mFree.push_back(segment);
+		return false;
+	}
+
+	mNextSequence++;
+
+	segment->Sequence = header.Sequence;
+	segment->Written = segment->Flushed = SegmentHeaderSize;
+	segment->Live = 0;
+	segment->Released = 0;
+
+	mSegments.push_back(segment);
+
+	return true;
+}
+
+// needs mLock
+void MailSpool::Recycle()
+{
+	// oldest first only, release records in later segments may refer to mails in earlier ones
+	while (mSegments.size() > 1)
+	{
+		auto segment = mSegments.front();
+
+		if (segment->Live > 0 || segment->Released > mCommitted || segment->Flushed < segment->Written)
+		{
+			break;
+		}
+
+		mSegments.pop_front();
+
+		// a free segment must never replay, its adds may have their releases in a segment that gets deleted later
+		bool keep = mFree.size() < MaxFreeSegments;
+
+		if (keep)
+		{
+			SegmentHeader header = { 0 };
+
+			std::memcpy(segment->File->GetData(), &header, sizeof(header));
+
+			keep = segment->File->Flush(0, sizeof(header));
+		}
+
+		if (keep)
+		{
+			segment->Sequence = 0;
+
+			mFree.push_back(segment);
+		}
+		else
+		{
+			auto path = segment->Path;
+
+			segment.reset();
+
+			std::error_code ec;
+			std::filesystem::remove(path, ec);
+		}
+	}
+}
+
+std::uint64_t MailSpool::Append(const Utf8String& subject, const Utf8String& message, const PlatformString& key)
+{
+	std::vector<byte> payload;
+	payload.reserve(subject.size() + message.size() + key.size() + 12);
+
+	PutField(payload, subject);
+	PutField(payload, message);
+	PutField(payload, PlatformStringToUtf8(key));
+
+	const std::lock_guard<std::mutex> lock(mLock);
+
+	auto id = mNextId;
+
+	Location location;
+
+	if (!this->Write(RecordAdd, id, payload, &location))
+	{
+		return 0;
+	}
+
+	mNextId++;
+
+	mIndex[id] = location;
+	location.Owner->Live++;
+
+	return id;
+}
+
+bool MailSpool::Load(std::uint64_t id, Utf8String* subject, Utf8String* message)
+{
+	const std::lock_guard<std::mutex> lock(mLock);
+
+	auto it = mIndex.find(id);
+
+	if (it == mIndex.end())
+	{
+		return false;
+	}
+
+	return this->Read(it->second, id, subject, message, nullptr);
+}
+
+void MailSpool::Release(std::uint64_t id)
+{
+	const std::lock_guard<std::mutex> lock(mLock);
+
+	auto it = mIndex.find(id);
+
+	if (it == mIndex.end())
+	{
+		return;
+	}
+
+	// without the record the mail comes back after a restart, sent twice rather than lost
+	this->Write(RecordRelease, id, std::span<const byte>(), nullptr);
+
+	it->second.Owner->Live--;
+	it->second.Owner->Released = mAppended;
+
+	mIndex.erase(it);
+}
+
+bool MailSpool::Commit()
+{
+	std::unique_lock<std::mutex> lock(mLock);
+
+	auto target = mAppended;
+
+	while (mCommitted < target)
+	{
+		if (mSyncing)
+		{
+			mCommitDone.wait(lock);
+			continue;
+		}
+
+		mSyncing = true;
+
+		auto upto = mAppended;
+
+		struct Dirty
+		{
+			std::shared_ptr<Segment> Owner;
+			std::uint64_t Sequence;
+			size_t From;
+			size_t To;
+		};
+
+		std::vector<Dirty> dirty;
+
+		for (auto& segment : mSegments)
+		{
+			if (segment->Written > segment->Flushed)
+			{
+				dirty.push_back({ segment, segment->Sequence, segment->Flushed, segment->Written });
+			}
+		}
+
+		lock.unlock();
+
+		bool ok = true;
+
+		for (auto& range : dirty)
+		{
+			ok = range.Owner->File->Flush(range.From, range.To - range.From) && ok;
+		}
+
+		lock.lock();
+
+		mSyncing = false;
+
+		if (ok)
+		{
+			for (auto& range : dirty)
+			{
+				if (range.Owner->Sequence == range.Sequence)
+				{
+					range.Owner->Flushed = std::max(range.Owner->Flushed, range.To);
+				}
+			}
+
+			mCommitted = std::max(mCommitted, upto);
+		}
+
+		mCommitDone.notify_all();
+
+		if (!ok)
+		{
+			ConsoleErr(PLATFORMSTR("Unable to flush the mail spool!"));
+			return false;
+		}
+	}
+
+	this->Recycle();
+
+	return true;
+}
+
+size_t MailSpool::GetCount()
+{
+	const std::lock_guard<std::mutex> lock(mLock);
+
+	return mIndex.size();
+}
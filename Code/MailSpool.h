@@ -0,0 +1,88 @@
+// Author: Martin Wetzko
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "Shared.h"
+#include <span>
+#include <unordered_map>
+
+// append only log of the mails not sent yet, split into memory mapped segments
+class MailSpool
+{
+public:
+	struct Pending
+	{
+		std::uint64_t Id;
+		Utf8String Subject;
+		PlatformString Key;
+	};
+
+private:
+	struct Segment
+	{
+		std::filesystem::path Path;
+		std::shared_ptr<PlatformMappedFile> File;
+		std::uint64_t Sequence;
+		size_t Written;
+		size_t Flushed;
+
+		// mails added here and not released yet
+		size_t Live;
+
+		// commit ticket of the last release of a mail added here
+		std::uint64_t Released;
+	};
+
+	struct Location
+	{
+		std::shared_ptr<Segment> Owner;
+		size_t Offset;
+	};
+
+	std::filesystem::path mDirectory;
+	size_t mSegmentSize;
+
+	// oldest first, records are appended to the last one
+	std::deque<std::shared_ptr<Segment>> mSegments;
+	std::vector<std::shared_ptr<Segment>> mFree;
+	std::unordered_map<std::uint64_t, Location> mIndex;
+
+	std::uint64_t mNextId;
+	std::uint64_t mNextSequence;
+	std::uint64_t mNextFile;
+
+	// group commit, one thread flushes for everybody who appended in the meantime
+	std::uint64_t mAppended;
+	std::uint64_t mCommitted;
+	bool mSyncing;
+	std::condition_variable mCommitDone;
+	std::mutex mLock;
+
+	bool Write(std::uint32_t, std::uint64_t, std::span<const byte>, Location*);
+	bool Read(const Location&, std::uint64_t, Utf8String*, Utf8String*, PlatformString*);
+	bool Rotate();
+	void Recycle();
+
+public:
+	MailSpool(size_t);
+
+	// replays the segments found in the directory, pending mails are returned oldest first
+	bool Open(const std::filesystem::path&, std::vector<Pending>*);
+
+	// returns the id of the stored mail or 0, it is durable after the next commit
+	std::uint64_t Append(const Utf8String&, const Utf8String&, const PlatformString&);
+	bool Load(std::uint64_t, Utf8String*, Utf8String*);
+	void Release(std::uint64_t);
+
+	// blocks until everything appended or released so far is on the disk
+	bool Commit();
+
+	size_t GetCount();
+};
@@ -8,57 +8,248 @@
 // SOFTWARE.
 
 #include "Shared.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "MailSink.h"
 #include "SIM800C.h"
+#include "MailSpool.h"
 #include "nlohmann/json.hpp"
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <charconv>
 
 std::filesystem::path RootPath;
 
+// a port without thread is driven by the modem reactor
 std::map<PlatformString, std::shared_ptr<std::thread>> Ports;
 std::mutex PortsLock;
+std::condition_variable PortsChanged;
+
+// threads of removed ports, joined by the main loop
+std::vector<std::shared_ptr<std::thread>> FinishedPorts;
+bool UseModemReactor = false;
+
+// given with -ports, replaces the discovery of modems, e.g. the ptys of the simulator
+std::vector<PlatformString> FixedPorts;
 
 void HandleTimer();
+void FindCommPorts();
+void Shutdown();
+void ReportEmailQueue();
+void ReportLatency();
+void RunMailBench(size_t);
+size_t GetEmailQueueDepth();
 bool GetCommDevice(const std::filesystem::path&, const PlatformString&, SIM800C*);
-void RemoveCommPort(const PlatformString&);
+bool StartModemReactor(size_t);
+bool AttachModemReactor(const std::filesystem::path&, const PlatformString&);
+void StopModemReactor();
+bool StartHotplugMonitor();
+void StopHotplugMonitor();
+bool StartMetricsServer(const Utf8String&, std::uint16_t);
+void StopMetricsServer();
 void ProcessCommPort(const PlatformString&);
 void ProcessCommLoop(SIM800C&);
-void OnNewSms(SIM800C&, const PlatformString&, const PlatformString&, const PlatformString&);
-void OnNewCaller(SIM800C&, const PlatformString&, const PlatformString&);
+bool OnNewSms(SIM800C&, const Utf8String&, const Utf8String&, const Utf8String&, bool);
+bool OnCommitSms(SIM800C&);
+void OnNewCaller(SIM800C&, const Utf8String&, const Utf8String&);
 
 PlatformString smtpusername;
 PlatformString smtppassword;
 PlatformString smtpserver;
 PlatformString smtpfromto;
+std::shared_ptr<SmtpTransport> MailTransport;
 
 struct EmailData
 {
-	PlatformString Subject;
-	PlatformString Message;
+	Utf8String Subject;
+	Utf8String Message;
+
+	// mails with the same key are delivered in order, usually the port of the device
+	PlatformString Key;
+
+	std::uint64_t Id = 0;
+
+	// the spool record holding this mail, the message is dropped from memory while spilled
+	std::uint64_t SpoolId = 0;
+	bool Spilled = false;
+
+	int Attempts = 0;
+	bool InFlight = false;
+	bool Unreadable = false;
+	std::chrono::steady_clock::time_point NotBefore;
+	std::chrono::steady_clock::time_point Started;
+
+	// sent as X-SmsRouter-Trace, the stamps feed the latency of each stage
+	Utf8String TraceId;
+	SmsTrace Trace;
+	std::chrono::steady_clock::time_point Queued;
+	std::chrono::steady_clock::time_point Dequeued;
 };
 
-void DoEmailProcessingIfNecessary();
-void AddProcessEmail(const EmailData&);
+void AddProcessEmail(EmailData&&);
 void ProcessSendEmail();
+bool SpoolEmail(EmailData&, bool = true);
+void ReleaseEmail(const EmailData&);
+
+// producers push into the queue, only the sender thread touches the outbox
+std::shared_ptr<MpscQueue<EmailData>> EmailQueue;
+
+// takes what does not fit into the queue, producers never wait for the sender
+std::deque<EmailData> EmailOverflow;
+std::atomic<size_t> EmailOverflowSize = 0;
+std::mutex EmailOverflowLock;
+std::vector<EmailData> EmailOutbox;
+std::atomic<size_t> EmailOutboxSize = 0;
+std::atomic<std::uint64_t> NextEmailId = 1;
+std::atomic<bool> EmailSenderWaiting = false;
+std::atomic<bool> EmailsClosed = false;
+
+// devices and mails in flight get this long to finish on exit
+std::chrono::seconds ShutdownTimeout = 20s;
+size_t ReportedHighWaterMark = 0;
+size_t MailQueueCapacity = 1024;
+size_t MailConcurrency = 4;
+bool MailOrderPerModem = true;
+
+// failed mails wait one more minute after every attempt, up to this long, and are never given up
+const int MaxEmailBackoffMinutes = 15;
+
+// mails are stored here before the SMS is deleted from the SIM card, null if disabled
+std::shared_ptr<MailSpool> Spool;
+const size_t SpoolSegmentSize = 1024 * 1024;
+
+// messages kept in the outbox beyond this are read back from the spool when they go out
+size_t MailMemoryBudget = 1024 * 1024;
+size_t EmailOutboxBytes = 0;
+
+// modem ports are raised to this rate when the modem supports it, 0 keeps the rate the modem answers at
+std::uint32_t MaxLinkSpeed = 115200;
+bool LinkFlowControl = false;
+
+enum class DigestMode
+{
+	Off,
+	Auto,
+	On
+};
+
+struct DigestEvent
+{
+	Utf8String Type;
+	Utf8String From;
+	Utf8String Receiver;
+	Utf8String Date;
+	Utf8String Text;
+	EmailData Single;
+};
+
+struct DigestData
+{
+	std::vector<DigestEvent> Events;
+	std::chrono::steady_clock::time_point Deadline;
+};
+
+void AddDigestEvent(SIM800C&, DigestEvent&&);
+void FlushDigests(bool);
+
+DigestMode EmailDigestMode = DigestMode::Auto;
+std::chrono::seconds DigestWindow = 60s;
+size_t DigestMaxEvents = 50;
+bool DigestPerModem = false;
+size_t DigestQueueThreshold = 10;
+std::chrono::milliseconds DigestLatencyThreshold = 15s;
+
+// keyed by port in per modem scope, a single empty key otherwise
+std::map<PlatformString, DigestData> Digests;
+bool DigestActive = false;
+std::chrono::steady_clock::time_point DigestWindowStart;
+size_t DigestWindowEvents = 0;
+size_t DigestLastWindowEvents = 0;
+std::mutex DigestsLock;
+
+std::atomic<long long> LastSendLatency = 0;
+
+// served with -metricsport, updated without locking
+MetricGauge& ModemsGauge = GetMetrics().Gauge("smsrouter_modems", "Devices currently processed.");
+MetricGauge& MailQueueDepthGauge = GetMetrics().Gauge("smsrouter_mail_queue_depth", "Mails queued for the sender or waiting in its outbox.");
+MetricHistogram& SmtpDurationHistogram = GetMetrics().Histogram("smsrouter_smtp_duration_seconds", "Time from starting a transfer until the server accepted or refused it.", { 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 120 });
+MetricCounter& MailsSentCounter = GetMetrics().Counter("smsrouter_mails_sent_total", "Mails accepted by the server.");
+MetricCounter& SmtpFailuresCounter = GetMetrics().Counter("smsrouter_smtp_failures_total", "Transfers that failed or were refused by the server.");
+MetricCounter& MailRetriesCounter = GetMetrics().Counter("smsrouter_mail_retries_total", "Failed mails scheduled to go out again.");
+MetricCounter& MailsDroppedCounter = GetMetrics().Counter("smsrouter_mails_dropped_total", "Mails taken out of the outbox because their spool record is unreadable, the record is kept.");
+
+struct LatencyStage
+{
+	const PlatformChar* Name;
+	MetricLatency& Latency;
+};
+
+MetricLatency& GetStageLatency(const Utf8String& stage)
+{
+	return GetMetrics().Latency("smsrouter_stage_latency_seconds", "Time a mail spent in each stage from +CMTI until the server accepted it.", { { "stage", stage } });
+}
+
+// between consecutive stamps of a mail, total from +CMTI to the server
+LatencyStage LatencyStages[] =
+{
+	{ PLATFORMSTR("listing"), GetStageLatency("listing") },
+	{ PLATFORMSTR("decode"), GetStageLatency("decode") },
+	{ PLATFORMSTR("queue"), GetStageLatency("queue") },
+	{ PLATFORMSTR("outbox"), GetStageLatency("outbox") },
+	{ PLATFORMSTR("delivery"), GetStageLatency("delivery") },
+	{ PLATFORMSTR("total"), GetStageLatency("total") }
+};
 
-std::vector<EmailData> Emails;
-std::mutex EmailsLock;
+// unique across restarts, the start time keeps ids of different runs apart
+const std::uint64_t TraceEpoch = (std::uint64_t)std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+std::atomic<std::uint64_t> NextTraceId = 1;
+std::atomic<bool> LatencyReportRequested = false;
 
 std::thread EmailThread;
-std::mutex EmailThreadLock;
 
 WaitResetEvent ExitReset;
 
-size_t GetRemainingThreads()
+void JoinFinishedPorts()
 {
-	const std::lock_guard<std::mutex> lock(PortsLock);
+	std::vector<std::shared_ptr<std::thread>> finished;
+
+	{
+		const std::lock_guard<std::mutex> lock(PortsLock);
+
+		finished.swap(FinishedPorts);
+	}
 
-	return Ports.size();
+	for (auto& thread : finished)
+	{
+		thread->join();
+	}
 }
 
 void PrintUsage(const std::vector<PlatformString>& args)
 {
-	ConsoleErr(PLATFORMSTR("Usage: "), args[0], PLATFORMSTR(" -username <username> -password <password> -serverurl <serverurl> -fromto <fromto>"));
+	ConsoleErr(PLATFORMSTR("Usage: "), args[0], PLATFORMSTR(" -username <username> -password <password> -serverurl <serverurl> -fromto <fromto> [-modemthreads <count>] [-shutdowntimeout <seconds>] [-logfile <path>] [-logsize <megabytes>] [-logage <hours>] [-loglevel <debug|info|error>] [-maxbaud <rate>] [-flowcontrol <on|off>] [-metricsport <port>] [-metricsaddress <ip>] [-ports <port,port,...>] [-testmail <on|off>]"
+		" [-spool <directory|off>] [-mailmemory <kilobytes>] [-mailqueue <count>] [-mailconcurrency <count>] [-mailorder <modem|none>] [-digest <off|auto|on>] [-digestwindow <seconds>] [-digestmax <count>] [-digestscope <global|modem>] [-digestqueue <count>] [-digestlatency <seconds>]"
+		" [-mailsink <port>] [-sinklatency <milliseconds>] [-sinkfailure <percent>] [-mailbench <count>]"));
+}
+
+// a whole decimal number in [min, max], anything else is a typo
+bool ParseNumber(const PlatformString& text, std::int64_t min, std::int64_t max, std::int64_t* value)
+{
+	auto utf8 = PlatformStringToUtf8(text);
+	auto end = utf8.data() + utf8.size();
+
+	std::int64_t number = 0;
+	auto [ptr, ec] = std::from_chars(utf8.data(), end, number);
+
+	if (utf8.empty() || ec != std::errc() || ptr != end || number < min || number > max)
+	{
+		return false;
+	}
+
+	*value = number;
+
+	return true;
 }
 
 int MainLoop(const std::vector<PlatformString>& args)
@@ -102,203 +293,1190 @@ int MainLoop(const std::vector<PlatformString>& args)
 		}
 	}
 
+	// checked before anything is started, 0 keeps the default where it is allowed
+	const std::tuple<const PlatformChar*, std::int64_t, std::int64_t> numberOptions[] =
+	{
+		{ PLATFORMSTR("logsize"), 0, 4095 },
+		{ PLATFORMSTR("logage"), 0, 24 * 365 },
+		{ PLATFORMSTR("mailqueue"), 1, 1024 * 1024 },
+		{ PLATFORMSTR("mailmemory"), 1, 4 * 1024 * 1024 - 1 },
+		{ PLATFORMSTR("mailconcurrency"), 1, 256 },
+		{ PLATFORMSTR("mailsink"), 1, 65535 },
+		{ PLATFORMSTR("sinklatency"), 0, 600000 },
+		{ PLATFORMSTR("sinkfailure"), 0, 100 },
+		{ PLATFORMSTR("modemthreads"), 0, 256 },
+		{ PLATFORMSTR("shutdowntimeout"), 1, 3600 },
+		{ PLATFORMSTR("maxbaud"), 0, 4000000 },
+		{ PLATFORMSTR("digestwindow"), 1, 24 * 3600 },
+		{ PLATFORMSTR("digestmax"), 1, 1000000 },
+		{ PLATFORMSTR("digestqueue"), 1, 1000000 },
+		{ PLATFORMSTR("digestlatency"), 1, 24 * 3600 },
+		{ PLATFORMSTR("metricsport"), 1, 65535 },
+		{ PLATFORMSTR("mailbench"), 1, 100000000 },
+	};
+
+	std::map<PlatformString, std::int64_t, PlatformCIComparer> numbers;
+
+	for (auto& [name, min, max] : numberOptions)
+	{
+		auto option = parsed.find(name);
+
+		if (option != parsed.end())
+		{
+			std::int64_t value;
+
+			if (!ParseNumber(option->second, min, max, &value))
+			{
+				ConsoleErr(PLATFORMSTR("Invalid value for -"), name, PLATFORMSTR(": \""), option->second, PLATFORMSTR("\", expected "), min, PLATFORMSTR(" to "), max);
+
+				PrintUsage(args);
+				return 1;
+			}
+
+			numbers[name] = value;
+		}
+	}
+
 	smtpusername = parsed[PLATFORMSTR("username")];
 	smtppassword = parsed[PLATFORMSTR("password")];
 	smtpserver = parsed[PLATFORMSTR("serverurl")];
 	smtpfromto = parsed[PLATFORMSTR("fromto")];
 
-#if !_DEBUG
-	if (!SendEmail(PLATFORMSTR("[TEST]"), PLATFORMSTR("[TEST]"), smtpusername, smtppassword, smtpserver, smtpfromto))
+	auto loglevel = parsed.find(PLATFORMSTR("loglevel"));
+
+	if (loglevel != parsed.end())
 	{
-		ConsoleErr(PLATFORMSTR("Failed to send test mail!"));
-		return 2;
+		if (Equal(loglevel->second, PlatformString(PLATFORMSTR("debug"))))
+		{
+			MinLogLevel = LogLevel::Debug;
+		}
+		else if (Equal(loglevel->second, PlatformString(PLATFORMSTR("error"))))
+		{
+			MinLogLevel = LogLevel::Error;
+		}
 	}
-#endif
 
-	HandleTimer();
+	// without a file the log goes to the console, a file is rotated in place and keeps the last three
+	auto logfile = parsed.find(PLATFORMSTR("logfile"));
+	auto logsize = numbers.find(PLATFORMSTR("logsize"));
+	auto logage = numbers.find(PLATFORMSTR("logage"));
 
-	while (!WaitExitOrTimeout(10s))
+	size_t logMaxSize = 10 * 1024 * 1024;
+	auto logMaxAge = std::chrono::hours(24);
+
+	if (logsize != numbers.end())
 	{
-		HandleTimer();
+		logMaxSize = (size_t)logsize->second * 1024 * 1024;
 	}
 
-	while (GetRemainingThreads() > 0)
+	if (logage != numbers.end())
 	{
-		std::this_thread::sleep_for(100ms);
+		logMaxAge = std::chrono::hours(logage->second);
 	}
 
-	if (EmailThread.joinable())
+	auto logpath = logfile != parsed.end() ? std::filesystem::path(logfile->second) : std::filesystem::path();
+
+	if (!StartLogger(logpath, logMaxSize, logMaxAge))
 	{
-		try
-		{
-			EmailThread.join();
-		}
-		catch (const std::exception&)
+		ConsoleErr(PLATFORMSTR("Unable to open the log file, logging to the console!"));
+
+		StartLogger(std::filesystem::path(), 0, 0s);
+	}
+
+	// more mails go to the overflow until the sender catches up
+	auto mailqueue = numbers.find(PLATFORMSTR("mailqueue"));
+
+	if (mailqueue != numbers.end())
+	{
+		MailQueueCapacity = mailqueue->second;
+	}
+
+	EmailQueue = std::make_shared<MpscQueue<EmailData>>(MailQueueCapacity);
+
+	auto mailmemory = numbers.find(PLATFORMSTR("mailmemory"));
+
+	if (mailmemory != numbers.end())
+	{
+		MailMemoryBudget = (size_t)mailmemory->second * 1024;
+	}
+
+	// pending mails of the last run are sent once the sender is up
+	std::vector<MailSpool::Pending> spooled;
+
+	auto spool = parsed.find(PLATFORMSTR("spool"));
+
+	if (spool == parsed.end() || !Equal(spool->second, PlatformString(PLATFORMSTR("off"))))
+	{
+		auto path = spool != parsed.end() && spool->second.size() > 0 ? std::filesystem::path(spool->second) : RootPath / PLATFORMSTR("spool");
+
+		Spool = std::make_shared<MailSpool>(SpoolSegmentSize);
+
+		if (!Spool->Open(path, &spooled))
 		{
-			// nothing
+			ConsoleErr(PLATFORMSTR("Unable to open the mail spool, mails are kept in memory only!"));
+
+			Spool.reset();
 		}
 	}
 
-	return 0;
-}
+	// mails in flight at the same time, each one on its own smtp session
+	auto mailconcurrency = numbers.find(PLATFORMSTR("mailconcurrency"));
 
-void EnsureCommPort(const PlatformString& port)
-{
-	const std::lock_guard<std::mutex> lock(PortsLock);
+	if (mailconcurrency != numbers.end())
+	{
+		MailConcurrency = mailconcurrency->second;
+	}
 
-	auto it = Ports.find(port);
+	auto mailorder = parsed.find(PLATFORMSTR("mailorder"));
 
-	if (it == Ports.end())
+	if (mailorder != parsed.end())
 	{
-		Ports.insert_or_assign(port, std::make_shared<std::thread>(ProcessCommPort, port));
+		MailOrderPerModem = !Equal(mailorder->second, PlatformString(PLATFORMSTR("none")));
 	}
-}
 
-void RemoveCommPort(const PlatformString& port)
-{
-	const std::lock_guard<std::mutex> lock(PortsLock);
+	// a local server dropping every mail, delivery can be measured without the provider
+	auto mailsink = numbers.find(PLATFORMSTR("mailsink"));
+	Utf8String sinkCertificate;
 
-	auto it = Ports.find(port);
+	if (mailsink != numbers.end())
+	{
+		MailSinkOptions options;
 
-	if (it != Ports.end())
+		auto sinklatency = numbers.find(PLATFORMSTR("sinklatency"));
+
+		if (sinklatency != numbers.end())
+		{
+			options.Latency = std::chrono::milliseconds(sinklatency->second);
+		}
+
+		auto sinkfailure = numbers.find(PLATFORMSTR("sinkfailure"));
+
+		if (sinkfailure != numbers.end())
+		{
+			options.FailureRate = sinkfailure->second / 100.0;
+		}
+
+		if (!StartMailSink((std::uint16_t)mailsink->second, options, &sinkCertificate))
+		{
+			// never fall back to the real server, the mails are meant to go nowhere
+			ConsoleErr(PLATFORMSTR("Unable to start the mail sink on port "), mailsink->second);
+
+			StopLogger();
+			return 2;
+		}
+
+		smtpserver = PlatformString(PLATFORMSTR("127.0.0.1:")).append(parsed[PLATFORMSTR("mailsink")]);
+
+		ConsoleOut(PLATFORMSTR("Mails go to the local sink at "), smtpserver);
+	}
+
+	MailTransport = std::make_shared<SmtpTransport>(smtpusername, smtppassword, smtpserver, smtpfromto, MailConcurrency);
+
+	if (sinkCertificate.size() > 0)
 	{
-		it->second->detach();
-		Ports.erase(it);
+		MailTransport->SetCertificate(sinkCertificate);
 	}
-}
 
-void ProcessCommPort(const PlatformString& port)
-{
-	ConsoleOut(PLATFORMSTR("Processing device at "), port);
+	// time to stop devices and finish mails in flight, systemd kills the process after 90 seconds by default
+	auto shutdowntimeout = numbers.find(PLATFORMSTR("shutdowntimeout"));
 
-	SIM800C sim;
-	if (GetCommDevice(RootPath, port, &sim))
+	if (shutdowntimeout != numbers.end())
 	{
-		ProcessCommLoop(sim);
+		ShutdownTimeout = std::chrono::seconds(shutdowntimeout->second);
 	}
 
-	RemoveCommPort(port);
-}
+	auto maxbaud = numbers.find(PLATFORMSTR("maxbaud"));
 
-void ProcessCommLoop(SIM800C& sim)
-{
-	sim.OnNewSms = OnNewSms;
-	sim.OnNewCaller = OnNewCaller;
+	if (maxbaud != numbers.end())
+	{
+		MaxLinkSpeed = (std::uint32_t)maxbaud->second;
+	}
 
-	if (!sim.Init())
+	// only with RTS/CTS wired to the modem, writes stall otherwise
+	auto flowcontrol = parsed.find(PLATFORMSTR("flowcontrol"));
+
+	if (flowcontrol != parsed.end())
 	{
-		return;
+		LinkFlowControl = Equal(flowcontrol->second, PlatformString(PLATFORMSTR("on")));
 	}
 
-	sim.OutputConsole(PLATFORMSTR("Ready. Waiting for event..."));
+	// auto switches to digests while the mail queue or the server can not keep up
+	auto digest = parsed.find(PLATFORMSTR("digest"));
 
-	while (sim.PerformLoop())
+	if (digest != parsed.end())
 	{
-		DoEmailProcessingIfNecessary();
+		if (Equal(digest->second, PlatformString(PLATFORMSTR("off"))))
+		{
+			EmailDigestMode = DigestMode::Off;
+		}
+		else if (Equal(digest->second, PlatformString(PLATFORMSTR("on"))))
+		{
+			EmailDigestMode = DigestMode::On;
+		}
 	}
-}
 
-void OnNewSms(SIM800C& sim, const PlatformString& from, const PlatformString& date, const PlatformString& message)
-{
-	auto msg = PlatformString(PLATFORMSTR("Sender: ")).append(from)
-		.append(PLATFORMSTR("\r\n"))
-		.append(PLATFORMSTR("Receiver: ")).append(sim.GetSubscriberNumber())
-		.append(PLATFORMSTR("\r\n"))
-		.append(PLATFORMSTR("Date: ")).append(date)
-		.append(PLATFORMSTR("\r\n\r\n"))
-		.append(message);
+	auto digestwindow = numbers.find(PLATFORMSTR("digestwindow"));
 
-	EmailData ed = { PLATFORMSTR("SMS received"), msg };
+	if (digestwindow != numbers.end())
+	{
+		DigestWindow = std::chrono::seconds(digestwindow->second);
+	}
 
-	AddProcessEmail(ed);
-}
+	auto digestmax = numbers.find(PLATFORMSTR("digestmax"));
 
-void OnNewCaller(SIM800C& sim, const PlatformString& caller, const PlatformString& date)
-{
-	auto msg = PlatformString(PLATFORMSTR("Caller: ")).append(caller)
-		.append(PLATFORMSTR("\r\n"))
-		.append(PLATFORMSTR("Callee: ")).append(sim.GetSubscriberNumber())
-		.append(PLATFORMSTR("\r\n"))
-		.append(PLATFORMSTR("Date: ")).append(date);
+	if (digestmax != numbers.end())
+	{
+		DigestMaxEvents = digestmax->second;
+	}
 
-	EmailData ed = { PLATFORMSTR("Call received"), msg };
+	auto digestscope = parsed.find(PLATFORMSTR("digestscope"));
 
-	AddProcessEmail(ed);
-}
+	if (digestscope != parsed.end())
+	{
+		DigestPerModem = Equal(digestscope->second, PlatformString(PLATFORMSTR("modem")));
+	}
 
-void FireEmailThread()
-{
-	const std::lock_guard<std::mutex> lock(EmailThreadLock);
+	auto digestqueue = numbers.find(PLATFORMSTR("digestqueue"));
 
-	if (!EmailThread.joinable())
+	if (digestqueue != numbers.end())
 	{
-		EmailThread = std::thread(ProcessSendEmail);
+		DigestQueueThreshold = digestqueue->second;
 	}
-}
 
-void DoEmailProcessingIfNecessary()
-{
-	const std::lock_guard<std::mutex> lock(EmailsLock);
+	auto digestlatency = numbers.find(PLATFORMSTR("digestlatency"));
 
-	if (Emails.size() > 0)
+	if (digestlatency != numbers.end())
 	{
-		FireEmailThread();
+		DigestLatencyThreshold = std::chrono::seconds(digestlatency->second);
 	}
-}
 
-void AddProcessEmail(const EmailData& data)
-{
-	const std::lock_guard<std::mutex> lock(EmailsLock);
+	DigestWindowStart = std::chrono::steady_clock::now();
 
-	Emails.push_back(data);
+	// off for load tests and machines without a reachable server yet
+	auto testmail = parsed.find(PLATFORMSTR("testmail"));
 
-	FireEmailThread();
-}
+#if !_DEBUG
+	if ((testmail == parsed.end() || !Equal(testmail->second, PlatformString(PLATFORMSTR("off")))) && !MailTransport->Send("[TEST]", "[TEST]"))
+	{
+		ConsoleErr(PLATFORMSTR("Failed to send test mail!"));
 
-bool GetNextEmailData(EmailData* data)
-{
-	const std::lock_guard<std::mutex> lock(EmailsLock);
+		StopMailSink();
+		StopLogger();
+		return 2;
+	}
+#endif
 
-	auto it = Emails.begin();
+	// 0 keeps one thread per device, otherwise all devices share a fixed number of threads,
+	// started after the test mail so nothing is left running when it fails
+	auto modemthreads = numbers.find(PLATFORMSTR("modemthreads"));
 
-	if (it == Emails.end())
+	if (modemthreads != numbers.end() && modemthreads->second > 0)
 	{
-		return false;
+		UseModemReactor = StartModemReactor(modemthreads->second);
+
+		if (!UseModemReactor)
+		{
+			ConsoleErr(PLATFORMSTR("Modem reactor is not available, using one thread per device."));
+		}
 	}
 
-	*data = *it;
+	EmailThread = std::thread(ProcessSendEmail);
 
-	Emails.erase(it);
+	if (spooled.size() > 0)
+	{
+		ConsoleOut(PLATFORMSTR("Resending "), spooled.size(), PLATFORMSTR(" spooled mails"));
 
-	return true;
-}
+		for (auto& entry : spooled)
+		{
+			EmailData data = { entry.Subject, "", entry.Key };
+			data.SpoolId = entry.Id;
+			data.Spilled = true;
 
-void ProcessSendEmail()
-{
-	int num = 0;
+			AddProcessEmail(std::move(data));
+		}
+	}
 
-	EmailData data;
-	while (GetNextEmailData(&data))
+	// prometheus scrapes /metrics, only from this machine unless another address is given
+	auto metricsport = numbers.find(PLATFORMSTR("metricsport"));
+	auto metricsaddress = parsed.find(PLATFORMSTR("metricsaddress"));
+
+	if (metricsport != numbers.end())
 	{
-		if (SendEmail(data.Subject, data.Message, smtpusername, smtppassword, smtpserver, smtpfromto))
+		auto address = metricsaddress != parsed.end() && metricsaddress->second.size() > 0 ? PlatformStringToUtf8(metricsaddress->second) : Utf8String("127.0.0.1");
+
+		if (!StartMetricsServer(address, (std::uint16_t)metricsport->second))
 		{
-			num = 0;
+			ConsoleErr(PLATFORMSTR("Unable to serve metrics on port "), metricsport->second);
 		}
-		else
+	}
+
+	// only mails then, no devices are looked for
+	auto mailbench = numbers.find(PLATFORMSTR("mailbench"));
+
+	if (mailbench != numbers.end())
+	{
+		RunMailBench(mailbench->second);
+
+		Shutdown();
+
+		StopLogger();
+
+		return 0;
+	}
+
+	auto ports = parsed.find(PLATFORMSTR("ports"));
+
+	if (ports != parsed.end())
+	{
+		size_t pos = 0;
+
+		while (pos <= ports->second.size())
 		{
-			if ((num + 1) < 5)
+			auto end = std::min(ports->second.find(PLATFORMSTR(','), pos), ports->second.size());
+
+			if (end > pos)
 			{
-				num += 1;
+				FixedPorts.push_back(ports->second.substr(pos, end - pos));
 			}
 
-			if (WaitExitOrTimeout(num * 1min))
+			pos = end + 1;
+		}
+	}
+
+	// new devices show up right away where they can be watched, the timer only retries failed ones then
+	if (FixedPorts.size() > 0)
+	{
+		ConsoleOut(PLATFORMSTR("Using "), FixedPorts.size(), PLATFORMSTR(" given ports, not looking for devices."));
+	}
+	else if (!StartHotplugMonitor())
+	{
+		ConsoleOut(PLATFORMSTR("Hotplug events are not available, looking for devices every 10 seconds."));
+	}
+
+	FindCommPorts();
+
+	while (!WaitExitOrTimeout(10s))
+	{
+		JoinFinishedPorts();
+		FindCommPorts();
+		FlushDigests(false);
+		ReportEmailQueue();
+
+		if (LatencyReportRequested.exchange(false))
+		{
+			ReportLatency();
+		}
+	}
+
+	Shutdown();
+
+	StopLogger();
+
+	return 0;
+}
+
+// every phase only gets what is left until the deadline, mails still pending then stay in the spool
+void Shutdown()
+{
+	auto start = std::chrono::steady_clock::now();
+	auto deadline = start + ShutdownTimeout;
+	auto phase = start;
+
+	auto finish = [&phase](const PlatformChar* name)
+		{
+			auto now = std::chrono::steady_clock::now();
+
+			ConsoleOut(PLATFORMSTR("Shutdown: "), name, PLATFORMSTR(" took "), std::chrono::duration_cast<std::chrono::milliseconds>(now - phase).count(), PLATFORMSTR("ms"));
+
+			phase = now;
+		};
+
+	// serial waits end with the exit event, devices are gone once their port is removed
+	StopHotplugMonitor();
+	StopMetricsServer();
+
+	{
+		std::unique_lock<std::mutex> lock(PortsLock);
+
+		if (!PortsChanged.wait_until(lock, deadline, []() { return Ports.empty(); }))
+		{
+			for (auto& it : Ports)
 			{
-				break;
+				ConsoleErr(PLATFORMSTR("Device at "), it.first, PLATFORMSTR(" did not stop in time!"));
+
+				// the process ends without it
+				if (it.second)
+				{
+					it.second->detach();
+				}
 			}
+
+			Ports.clear();
 		}
 	}
 
-	const std::lock_guard<std::mutex> lock(EmailThreadLock);
+	JoinFinishedPorts();
+
+	if (UseModemReactor)
+	{
+		StopModemReactor();
+	}
+
+	finish(PLATFORMSTR("devices"));
+
+	// no more events can arrive, whatever is held back goes out now
+	FlushDigests(true);
+
+	finish(PLATFORMSTR("digests"));
 
-	EmailThread.detach();
-}
\ No newline at end of file
+	MailTransport->SetDeadline(deadline);
+
+	EmailsClosed = true;
+
+	MailTransport->Wakeup();
+
+	if (EmailThread.joinable())
+	{
+		try
+		{
+			EmailThread.join();
+		}
+		catch (const std::exception&)
+		{
+			// nothing
+		}
+	}
+
+	// after the mails in flight, they may be on their way to it
+	StopMailSink();
+
+	finish(PLATFORMSTR("mails"));
+
+	auto left = EmailOutbox.size() + EmailQueue->GetSize() + EmailOverflowSize.load();
+
+	if (Spool)
+	{
+		Spool->Commit();
+	}
+
+	if (left > 0)
+	{
+		if (Spool)
+		{
+			ConsoleOut(left, PLATFORMSTR(" mails are kept in the spool for the next start"));
+		}
+		else
+		{
+			ConsoleErr(left, PLATFORMSTR(" mails were not sent!"));
+		}
+	}
+
+	finish(PLATFORMSTR("spool"));
+
+	ConsoleOut(PLATFORMSTR("Shutdown finished after "), std::chrono::duration_cast<std::chrono::milliseconds>(phase - start).count(), PLATFORMSTR("ms"));
+}
+
+// a given port that failed is opened again like a rediscovered device
+void FindCommPorts()
+{
+	if (FixedPorts.empty())
+	{
+		HandleTimer();
+		return;
+	}
+
+	for (auto& port : FixedPorts)
+	{
+		EnsureCommPort(port);
+	}
+}
+
+void EnsureCommPort(const PlatformString& port)
+{
+	const std::lock_guard<std::mutex> lock(PortsLock);
+
+	auto it = Ports.find(port);
+
+	if (it == Ports.end())
+	{
+		if (!UseModemReactor)
+		{
+			Ports.insert_or_assign(port, std::make_shared<std::thread>(ProcessCommPort, port));
+		}
+		else
+		{
+			// registered before attaching, the reactor may drop the device right away
+			Ports.insert_or_assign(port, std::shared_ptr<std::thread>());
+
+			if (!AttachModemReactor(RootPath, port))
+			{
+				Ports.erase(port);
+			}
+		}
+
+		ModemsGauge.Set((double)Ports.size());
+	}
+}
+
+void RemoveCommPort(const PlatformString& port)
+{
+	const std::lock_guard<std::mutex> lock(PortsLock);
+
+	auto it = Ports.find(port);
+
+	if (it != Ports.end())
+	{
+		if (it->second)
+		{
+			FinishedPorts.push_back(it->second);
+		}
+
+		Ports.erase(it);
+
+		ModemsGauge.Set((double)Ports.size());
+
+		PortsChanged.notify_all();
+	}
+}
+
+void ProcessCommPort(const PlatformString& port)
+{
+	ConsoleOut(PLATFORMSTR("Processing device at "), port);
+
+	SIM800C sim;
+	if (GetCommDevice(RootPath, port, &sim))
+	{
+		ProcessCommLoop(sim);
+	}
+
+	RemoveCommPort(port);
+}
+
+void PrepareCommDevice(SIM800C& sim)
+{
+	sim.OnNewSms = OnNewSms;
+	sim.OnCommitSms = OnCommitSms;
+	sim.OnNewCaller = OnNewCaller;
+	sim.SetLinkOptions(MaxLinkSpeed, LinkFlowControl);
+}
+
+void ProcessCommLoop(SIM800C& sim)
+{
+	PrepareCommDevice(sim);
+
+	if (!sim.Init())
+	{
+		return;
+	}
+
+	while (sim.PerformLoop())
+	{
+	}
+}
+
+bool OnNewSms(SIM800C& sim, const Utf8String& from, const Utf8String& date, const Utf8String& message, bool partial)
+{
+	auto msg = Utf8String("Sender: ").append(from)
+		.append("\r\n")
+		.append("Receiver: ").append(sim.GetSubscriberNumber())
+		.append("\r\n")
+		.append("Date: ").append(date)
+		.append("\r\n\r\n")
+		.append(message);
+
+	EmailData ed = { partial ? "SMS received (incomplete)" : "SMS received", msg, sim.GetPort() };
+	ed.Trace = sim.GetSmsTrace();
+
+	// committed with the rest of the listing before the SIM card forgets it
+	bool stored = SpoolEmail(ed, false);
+
+	AddDigestEvent(sim, { partial ? "SMS*" : "SMS", from, sim.GetSubscriberNumber(), date, message, std::move(ed) });
+
+	return stored;
+}
+
+bool OnCommitSms(SIM800C&)
+{
+	return !Spool || Spool->Commit();
+}
+
+void OnNewCaller(SIM800C& sim, const Utf8String& caller, const Utf8String& date)
+{
+	auto msg = Utf8String("Caller: ").append(caller)
+		.append("\r\n")
+		.append("Callee: ").append(sim.GetSubscriberNumber())
+		.append("\r\n")
+		.append("Date: ").append(date);
+
+	EmailData ed = { "Call received", msg, sim.GetPort() };
+
+	SpoolEmail(ed);
+
+	AddDigestEvent(sim, { "Call", caller, sim.GetSubscriberNumber(), date, "", std::move(ed) });
+}
+
+size_t GetEmailQueueDepth()
+{
+	return EmailQueue->GetSize() + EmailOverflowSize.load() + EmailOutboxSize.load();
+}
+
+void ReportEmailQueue()
+{
+	size_t mark = EmailQueue->GetHighWaterMark();
+
+	if (mark > ReportedHighWaterMark)
+	{
+		ReportedHighWaterMark = mark;
+
+		ConsoleOut(PLATFORMSTR("Mail queue high water mark: "), mark, PLATFORMSTR(" of "), EmailQueue->GetCapacity());
+	}
+}
+
+// needs DigestsLock
+void UpdateDigestState(std::chrono::steady_clock::time_point now)
+{
+	if (now - DigestWindowStart >= DigestWindow)
+	{
+		DigestWindowStart = now;
+		DigestLastWindowEvents = DigestWindowEvents;
+		DigestWindowEvents = 0;
+	}
+
+	if (EmailDigestMode != DigestMode::Auto)
+	{
+		DigestActive = EmailDigestMode == DigestMode::On;
+		return;
+	}
+
+	size_t depth = GetEmailQueueDepth();
+	auto latency = std::chrono::milliseconds(LastSendLatency.load());
+
+	if (!DigestActive)
+	{
+		if (depth >= DigestQueueThreshold || latency >= DigestLatencyThreshold)
+		{
+			DigestActive = true;
+			DigestWindowStart = now;
+			DigestWindowEvents = 0;
+
+			ConsoleOut(PLATFORMSTR("Switching to digest mode, "), depth, PLATFORMSTR(" mails queued, last one took "), latency.count(), PLATFORMSTR("ms"));
+		}
+	}
+	else if (depth == 0 && latency < DigestLatencyThreshold / 2 && DigestWindowEvents < DigestQueueThreshold && DigestLastWindowEvents < DigestQueueThreshold)
+	{
+		// the queue is drained and the burst is over
+		DigestActive = false;
+
+		ConsoleOut(PLATFORMSTR("Leaving digest mode"));
+	}
+}
+
+EmailData RenderDigest(const std::vector<DigestEvent>& events)
+{
+	if (events.size() == 1)
+	{
+		return events.front().Single;
+	}
+
+	size_t sms = 0;
+	size_t calls = 0;
+	size_t partial = 0;
+
+	for (auto& event : events)
+	{
+		if (event.Type == "Call")
+		{
+			calls++;
+		}
+		else
+		{
+			sms++;
+		}
+
+		if (event.Type == "SMS*")
+		{
+			partial++;
+		}
+	}
+
+	auto summary = std::to_string(sms).append(" SMS, ").append(std::to_string(calls)).append(" calls");
+
+	std::stringstream strm;
+
+	strm << summary << (partial > 0 ? ", * marks an incomplete message" : "") << "\r\n\r\n"
+		<< std::left << std::setw(6) << "Type" << std::setw(28) << "Date" << std::setw(18) << "From" << std::setw(18) << "Receiver" << "Text\r\n";
+
+	for (auto& event : events)
+	{
+		Utf8String text = event.Text;
+
+		// one row per event
+		std::replace_if(text.begin(), text.end(), [](Utf8Char c) { return c == '\r' || c == '\n'; }, ' ');
+
+		strm << std::left << std::setw(6) << event.Type << std::setw(28) << event.Date << std::setw(18) << event.From << std::setw(18) << event.Receiver << text << "\r\n";
+	}
+
+	EmailData email = { Utf8String("Digest: ").append(summary), strm.str() };
+
+	// measured from the oldest event, the time held back counts as queued
+	email.Trace = events.front().Single.Trace;
+
+	return email;
+}
+
+// the digest replaces the spool records of its events
+void QueueDigest(const PlatformString& key, const std::vector<DigestEvent>& events)
+{
+	auto email = RenderDigest(events);
+
+	email.Key = key;
+
+	if (events.size() > 1 && SpoolEmail(email))
+	{
+		for (auto& event : events)
+		{
+			ReleaseEmail(event.Single);
+		}
+	}
+
+	AddProcessEmail(std::move(email));
+}
+
+void AddDigestEvent(SIM800C& sim, DigestEvent&& event)
+{
+	const std::lock_guard<std::mutex> lock(DigestsLock);
+
+	auto now = std::chrono::steady_clock::now();
+
+	UpdateDigestState(now);
+
+	DigestWindowEvents++;
+
+	if (!DigestActive && Digests.empty())
+	{
+		AddProcessEmail(std::move(event.Single));
+		return;
+	}
+
+	auto key = DigestPerModem ? sim.GetPort() : PlatformString();
+
+	auto& digest = Digests[key];
+
+	if (digest.Events.empty())
+	{
+		digest.Deadline = now + DigestWindow;
+	}
+
+	digest.Events.push_back(std::move(event));
+
+	if (digest.Events.size() >= DigestMaxEvents)
+	{
+		QueueDigest(key, digest.Events);
+
+		Digests.erase(key);
+	}
+}
+
+void FlushDigests(bool all)
+{
+	const std::lock_guard<std::mutex> lock(DigestsLock);
+
+	auto now = std::chrono::steady_clock::now();
+
+	UpdateDigestState(now);
+
+	auto it = Digests.begin();
+
+	while (it != Digests.end())
+	{
+		if (all || !DigestActive || now >= it->second.Deadline)
+		{
+			QueueDigest(it->first, it->second.Events);
+
+			it = Digests.erase(it);
+		}
+		else
+		{
+			it++;
+		}
+	}
+}
+
+void AddProcessEmail(EmailData&& data)
+{
+	data.Id = NextEmailId++;
+	data.Queued = std::chrono::steady_clock::now();
+
+	if (data.TraceId.empty())
+	{
+		char id[40];
+		std::snprintf(id, sizeof(id), "%llx-%llx", (unsigned long long)TraceEpoch, (unsigned long long)NextTraceId++);
+
+		data.TraceId = id;
+	}
+
+	// once mails overflow the later ones follow them, the order per modem stays
+	if (EmailOverflowSize > 0 || !EmailQueue->TryPush(std::move(data)))
+	{
+		const std::lock_guard<std::mutex> lock(EmailOverflowLock);
+
+		if (EmailOverflow.empty())
+		{
+			ConsoleErr(PLATFORMSTR("Mail queue is full, spilling mails until the sender catches up..."));
+		}
+
+		// the spool has a copy, read back when it goes out
+		if (data.SpoolId != 0)
+		{
+			data.Spilled = true;
+			data.Message = Utf8String();
+		}
+
+		EmailOverflow.push_back(std::move(data));
+		EmailOverflowSize = EmailOverflow.size();
+	}
+
+	MailQueueDepthGauge.Set((double)GetEmailQueueDepth());
+
+	// pairs with the fence in ProcessSendEmail, either the sender sees the mail or we see it waiting
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	if (EmailSenderWaiting.exchange(false))
+	{
+		MailTransport->Wakeup();
+	}
+}
+
+bool SpoolEmail(EmailData& data, bool commit)
+{
+	if (!Spool)
+	{
+		return true;
+	}
+
+	auto id = Spool->Append(data.Subject, data.Message, data.Key);
+
+	if (id == 0 || (commit && !Spool->Commit()))
+	{
+		ConsoleErr(PLATFORMSTR("Unable to spool mail: "), data.Subject);
+		return false;
+	}
+
+	data.SpoolId = id;
+
+	return true;
+}
+
+// the release is durable with the next commit, until then a crash sends the mail again
+void ReleaseEmail(const EmailData& data)
+{
+	if (Spool && data.SpoolId != 0)
+	{
+		Spool->Release(data.SpoolId);
+	}
+}
+
+// only called by the sender, the spool record is released by the caller once the mail is delivered, never otherwise
+std::vector<EmailData>::iterator RemoveEmail(std::vector<EmailData>::iterator it)
+{
+	if (!it->Spilled)
+	{
+		EmailOutboxBytes -= it->Message.size();
+	}
+
+	return EmailOutbox.erase(it);
+}
+
+void UpdateEmailOutboxSize()
+{
+	EmailOutboxSize = EmailOutbox.size();
+
+	MailQueueDepthGauge.Set((double)GetEmailQueueDepth());
+}
+
+// only called by the sender
+void TakeEmail(EmailData&& data)
+{
+	data.Dequeued = std::chrono::steady_clock::now();
+
+	if (data.Spilled || (data.SpoolId != 0 && EmailOutboxBytes + data.Message.size() > MailMemoryBudget))
+	{
+		// over budget, the spool has a copy
+		data.Spilled = true;
+		data.Message = Utf8String();
+	}
+	else
+	{
+		EmailOutboxBytes += data.Message.size();
+	}
+
+	EmailOutbox.push_back(std::move(data));
+}
+
+void TakeEmails()
+{
+	EmailData data;
+
+	while (EmailQueue->TryPop(&data))
+	{
+		TakeEmail(std::move(data));
+	}
+
+	// after the queue, producers only push there again once the overflow is empty
+	std::deque<EmailData> overflow;
+
+	if (EmailOverflowSize > 0)
+	{
+		const std::lock_guard<std::mutex> lock(EmailOverflowLock);
+
+		overflow.swap(EmailOverflow);
+		EmailOverflowSize = 0;
+	}
+
+	for (auto& item : overflow)
+	{
+		TakeEmail(std::move(item));
+	}
+
+	UpdateEmailOutboxSize();
+}
+
+// starts whatever may go out now and returns how long the earliest delayed mail still has to wait
+std::chrono::steady_clock::duration StartEmails()
+{
+	auto now = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::duration wait = 1min;
+
+	std::vector<const PlatformString*> blocked;
+
+	for (auto& data : EmailOutbox)
+	{
+		if (MailTransport->GetActive() >= MailTransport->GetCapacity())
+		{
+			break;
+		}
+
+		bool ordered = MailOrderPerModem && std::any_of(blocked.begin(), blocked.end(), [&](const PlatformString* key) { return *key == data.Key; });
+
+		if (MailOrderPerModem)
+		{
+			blocked.push_back(&data.Key);
+		}
+
+		if (data.InFlight || ordered)
+		{
+			continue;
+		}
+
+		if (data.NotBefore > now)
+		{
+			wait = std::min(wait, data.NotBefore - now);
+			continue;
+		}
+
+		Utf8String spilled;
+
+		if (data.Spilled && !Spool->Load(data.SpoolId, nullptr, &spilled))
+		{
+			// the record stays, the next start tries to read it again
+			ConsoleErr(PLATFORMSTR("Spooled mail is unreadable, skipping it: "), data.Subject);
+
+			MailsDroppedCounter.Increment();
+
+			data.Unreadable = true;
+			continue;
+		}
+
+		auto headers = Utf8String("X-SmsRouter-Trace: ").append(data.TraceId).append("\r\n");
+
+		if (MailTransport->Start(data.Subject, data.Spilled ? spilled : data.Message, data.Id, headers))
+		{
+			data.InFlight = true;
+			data.Started = now;
+		}
+	}
+
+	auto it = EmailOutbox.begin();
+
+	while (it != EmailOutbox.end())
+	{
+		it = !it->InFlight && it->Unreadable ? RemoveEmail(it) : std::next(it);
+	}
+
+	UpdateEmailOutboxSize();
+
+	return wait;
+}
+
+// unset stamps skip their stage, calls and replayed mails only have the ones of the sender
+void RecordLatency(const EmailData& data, std::chrono::steady_clock::time_point sent)
+{
+	const std::chrono::steady_clock::time_point stamps[] = { data.Trace.Indicated, data.Trace.Listed, data.Trace.Parsed, data.Queued, data.Dequeued, sent };
+	const std::chrono::steady_clock::time_point unset;
+
+	for (size_t i = 0; i + 1 < std::size(stamps); i++)
+	{
+		if (stamps[i] != unset && stamps[i + 1] != unset)
+		{
+			LatencyStages[i].Latency.Record(stamps[i + 1] - stamps[i]);
+		}
+	}
+
+	if (data.Trace.Indicated != unset)
+	{
+		LatencyStages[std::size(stamps) - 1].Latency.Record(sent - data.Trace.Indicated);
+	}
+}
+
+void ReportLatency()
+{
+	auto ms = [](std::chrono::microseconds value) { return value.count() / 1000.0; };
+
+	for (auto& stage : LatencyStages)
+	{
+		ConsoleOut(PLATFORMSTR("Latency of "), stage.Name, PLATFORMSTR(": "), stage.Latency.GetCount(), PLATFORMSTR(" mails, p50 "), ms(stage.Latency.GetQuantile(0.5)),
+			PLATFORMSTR("ms, p90 "), ms(stage.Latency.GetQuantile(0.9)), PLATFORMSTR("ms, p99 "), ms(stage.Latency.GetQuantile(0.99)), PLATFORMSTR("ms, max "), ms(stage.Latency.GetMax()), PLATFORMSTR("ms"));
+	}
+}
+
+// mails like received SMS through the queue, the spool and the transport, waits until every one is sent or dropped
+void RunMailBench(size_t count)
+{
+	auto sent = MailsSentCounter.Get();
+	auto dropped = MailsDroppedCounter.Get();
+	auto failures = SmtpFailuresCounter.Get();
+	auto& total = LatencyStages[std::size(LatencyStages) - 1].Latency;
+
+	ConsoleOut(PLATFORMSTR("Benchmark: sending "), count, PLATFORMSTR(" mails..."));
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < count && !WaitExitOrTimeout(0ms); i++)
+	{
+		// one key per session like that many modems, a single key would send them one after the other
+		EmailData data = { "SMS received", "Sender: +4915550000000\r\nReceiver: +4915550000001\r\n\r\nBenchmark message " + std::to_string(i + 1),
+			Utf8ToPlatformString("bench" + std::to_string(i % MailConcurrency)) };
+
+		// counted from here like an SMS from its +CMTI
+		data.Trace.Indicated = std::chrono::steady_clock::now();
+
+		SpoolEmail(data);
+		AddProcessEmail(std::move(data));
+	}
+
+	while (MailsSentCounter.Get() - sent + MailsDroppedCounter.Get() - dropped < count && !WaitExitOrTimeout(100ms))
+	{
+	}
+
+	auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	auto done = MailsSentCounter.Get() - sent;
+	auto ms = [](std::chrono::microseconds value) { return value.count() / 1000.0; };
+
+	ConsoleOut(PLATFORMSTR("Benchmark: "), done, PLATFORMSTR(" of "), count, PLATFORMSTR(" mails sent in "), elapsed, PLATFORMSTR("s, "), done / elapsed, PLATFORMSTR(" mails/s, p50 "),
+		ms(total.GetQuantile(0.5)), PLATFORMSTR("ms, p99 "), ms(total.GetQuantile(0.99)), PLATFORMSTR("ms, "), SmtpFailuresCounter.Get() - failures, PLATFORMSTR(" failed transfers"));
+
+	ReportLatency();
+}
+
+// drops accepted mails from the outbox, failed ones wait and go out again until the server takes them
+void RetireEmails(const std::vector<std::pair<std::uint64_t, bool>>& done)
+{
+	auto now = std::chrono::steady_clock::now();
+
+	for (auto& [id, sent] : done)
+	{
+		auto it = std::find_if(EmailOutbox.begin(), EmailOutbox.end(), [&](const EmailData& data) { return data.Id == id; });
+
+		if (it == EmailOutbox.end())
+		{
+			continue;
+		}
+
+		LastSendLatency = std::chrono::duration_cast<std::chrono::milliseconds>(now - it->Started).count();
+
+		SmtpDurationHistogram.Observe(std::chrono::duration<double>(now - it->Started).count());
+
+		if (sent)
+		{
+			MailsSentCounter.Increment();
+
+			RecordLatency(*it, now);
+
+			ReleaseEmail(*it);
+			RemoveEmail(it);
+			continue;
+		}
+
+		SmtpFailuresCounter.Increment();
+
+		it->InFlight = false;
+		it->Attempts++;
+
+		// the SMS is gone from the SIM card already, an outage of the server must not lose it
+		if (it->Attempts % 10 == 0)
+		{
+			ConsoleErr(PLATFORMSTR("Mail still not sent after "), it->Attempts, PLATFORMSTR(" attempts, retrying: "), it->Subject);
+		}
+
+		MailRetriesCounter.Increment();
+
+		it->NotBefore = now + std::min(it->Attempts, MaxEmailBackoffMinutes) * 1min;
+	}
+
+	UpdateEmailOutboxSize();
+}
+
+// lives as long as the main loop, sleeps in the transport until a mail arrives or a transfer finishes
+void ProcessSendEmail()
+{
+	std::vector<std::pair<std::uint64_t, bool>> done;
+
+	while (true)
+	{
+		bool closed = EmailsClosed;
+
+		TakeEmails();
+
+		auto wait = StartEmails();
+
+		if (closed && MailTransport->GetActive() == 0 && EmailQueue->GetSize() == 0 && EmailOverflowSize == 0)
+		{
+			// whatever is left waits for a retry that will not happen anymore
+			break;
+		}
+
+		if (closed)
+		{
+			auto remaining = MailTransport->GetDeadline() - std::chrono::steady_clock::now();
+
+			if (remaining <= 0s)
+			{
+				// the mails are not released, the spool sends them again on the next start
+				MailTransport->Cancel();
+				break;
+			}
+
+			wait = std::min(wait, remaining);
+		}
+
+		EmailSenderWaiting = true;
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		auto timeout = EmailQueue->GetSize() > 0 || EmailOverflowSize > 0 ? 0ms : std::chrono::duration_cast<std::chrono::milliseconds>(wait);
+
+		done.clear();
+
+		MailTransport->Perform(timeout, &done);
+
+		EmailSenderWaiting = false;
+
+		RetireEmails(done);
+
+		if (Spool && done.size() > 0)
+		{
+			// lets the spool recycle segments whose mails are all gone
+			Spool->Commit();
+		}
+	}
+}
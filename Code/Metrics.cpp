@@ -0,0 +1,302 @@
+// Author: Martin Wetzko
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "Shared.h"
+#include "Metrics.h"
+#include <charconv>
+#include <cmath>
+
+MetricRegistry& GetMetrics()
+{
+	// never destroyed, a device thread detached on shutdown may still count
+	static MetricRegistry* registry = new MetricRegistry();
+
+	return *registry;
+}
+
+void AppendMetricValue(Utf8String& out, double value)
+{
+	if (std::isinf(value))
+	{
+		out.append(value > 0 ? "+Inf" : "-Inf");
+		return;
+	}
+
+	if (std::isnan(value))
+	{
+		out.append("NaN");
+		return;
+	}
+
+	char buffer[32];
+	auto res = std::to_chars(buffer, buffer + sizeof(buffer), value);
+
+	out.append(buffer, res.ptr);
+}
+
+void AppendMetricValue(Utf8String& out, std::uint64_t value)
+{
+	out.append(std::to_string(value));
+}
+
+// name{labels} value, the extra label is used for the histogram bounds
+template<typename T>
+void AppendMetricLine(Utf8String& out, const Utf8String& name, const Utf8String& labels, std::string_view extra, T value)
+{
+	out.append(name);
+
+	if (labels.size() > 0 || extra.size() > 0)
+	{
+		out.append("{");
+		out.append(labels);
+
+		if (labels.size() > 0 && extra.size() > 0)
+		{
+			out.append(",");
+		}
+
+		out.append(extra);
+		out.append("}");
+	}
+
+	out.append(" ");
+	AppendMetricValue(out, value);
+	out.append("\n");
+}
+
+Utf8String FormatMetricLabels(const MetricLabels& labels)
+{
+	Utf8String out;
+
+	for (auto& [name, value] : labels)
+	{
+		if (out.size() > 0)
+		{
+			out.append(",");
+		}
+
+		out.append(name);
+		out.append("=\"");
+
+		for (auto c : value)
+		{
+			switch (c)
+			{
+			case '\\':
+				out.append("\\\\");
+				break;
+			case '"':
+				out.append("\\\"");
+				break;
+			case '\n':
+				out.append("\\n");
+				break;
+			default:
+				out.push_back(c);
+				break;
+			}
+		}
+
+		out.append("\"");
+	}
+
+	return out;
+}
+
+void MetricCounter::Render(Utf8String& out, const Utf8String& name, const Utf8String& labels) const
+{
+	AppendMetricLine(out, name, labels, "", this->Get());
+}
+
+void MetricGauge::Render(Utf8String& out, const Utf8String& name, const Utf8String& labels) const
+{
+	AppendMetricLine(out, name, labels, "", this->Get());
+}
+
+MetricHistogram::MetricHistogram(const std::vector<double>& bounds)
+{
+	mBounds = bounds;
+	std::sort(mBounds.begin(), mBounds.end());
+
+	mBuckets = std::make_unique<std::atomic<std::uint64_t>[]>(mBounds.size() + 1);
+}
+
+void MetricHistogram::Render(Utf8String& out, const Utf8String& name, const Utf8String& labels) const
+{
+	// buckets are read one after the other, a scrape may see an observation in the count but not yet in its bucket
+	std::uint64_t total = 0;
+
+	for (size_t i = 0; i <= mBounds.size(); i++)
+	{
+		total += mBuckets[i].load(std::memory_order_relaxed);
+
+		Utf8String le = "le=\"";
+		AppendMetricValue(le, i < mBounds.size() ? mBounds[i] : INFINITY);
+		le.append("\"");
+
+		AppendMetricLine(out, name + "_bucket", labels, le, total);
+	}
+
+	AppendMetricLine(out, name + "_sum", labels, "", mSum.load(std::memory_order_relaxed));
+	AppendMetricLine(out, name + "_count", labels, "", mCount.load(std::memory_order_relaxed));
+}
+
+MetricLatency::MetricLatency()
+{
+	mBuckets = std::make_unique<std::atomic<std::uint64_t>[]>(BucketCount);
+}
+
+std::chrono::microseconds MetricLatency::GetQuantile(double quantile) const
+{
+	auto count = this->GetCount();
+
+	if (count == 0)
+	{
+		return std::chrono::microseconds(0);
+	}
+
+	auto rank = std::max<std::uint64_t>((std::uint64_t)std::ceil(quantile * count), 1);
+	std::uint64_t seen = 0;
+
+	for (size_t i = 0; i < BucketCount; i++)
+	{
+		seen += mBuckets[i].load(std::memory_order_relaxed);
+
+		if (seen >= rank)
+		{
+			// inverse of GetBucket, every shift past the first adds half a row of buckets
+			size_t half = (size_t)1 << (SubBucketBits - 1);
+			int shift = i < 2 * half ? 0 : (int)(i / half) - 1;
+			auto sub = i - ((size_t)shift * half);
+			auto highest = (((std::uint64_t)sub + 1) << shift) - 1;
+
+			return std::min(std::chrono::microseconds(highest), this->GetMax());
+		}
+	}
+
+	return this->GetMax();
+}
+
+void MetricLatency::Render(Utf8String& out, const Utf8String& name, const Utf8String& labels) const
+{
+	static constexpr std::pair<double, std::string_view> Quantiles[] = { { 0.5, "quantile=\"0.5\"" }, { 0.9, "quantile=\"0.9\"" }, { 0.99, "quantile=\"0.99\"" }, { 1.0, "quantile=\"1\"" } };
+
+	for (auto& [quantile, label] : Quantiles)
+	{
+		AppendMetricLine(out, name, labels, label, std::chrono::duration<double>(this->GetQuantile(quantile)).count());
+	}
+
+	AppendMetricLine(out, name + "_sum", labels, "", mSum.load(std::memory_order_relaxed) / 1e6);
+	AppendMetricLine(out, name + "_count", labels, "", this->GetCount());
+}
+
+template<typename T, typename... Args>
+T& MetricRegistry::Get(MetricType type, const Utf8String& name, const Utf8String& help, const MetricLabels& labels, Args&&... args)
+{
+	const std::lock_guard<std::mutex> lock(mLock);
+
+	auto& family = mFamilies[name];
+
+	if (family.Series.empty())
+	{
+		family.Help = help;
+		family.Type = type;
+	}
+
+	auto& series = family.Series[FormatMetricLabels(labels)];
+
+	if (!series)
+	{
+		series = std::make_unique<T>(std::forward<Args>(args)...);
+	}
+
+	// one name always has one type
+	return static_cast<T&>(*series);
+}
+
+MetricCounter& MetricRegistry::Counter(const Utf8String& name, const Utf8String& help, const MetricLabels& labels)
+{
+	return this->Get<MetricCounter>(MetricType::Counter, name, help, labels);
+}
+
+MetricGauge& MetricRegistry::Gauge(const Utf8String& name, const Utf8String& help, const MetricLabels& labels)
+{
+	return this->Get<MetricGauge>(MetricType::Gauge, name, help, labels);
+}
+
+MetricHistogram& MetricRegistry::Histogram(const Utf8String& name, const Utf8String& help, const std::vector<double>& bounds, const MetricLabels& labels)
+{
+	return this->Get<MetricHistogram>(MetricType::Histogram, name, help, labels, bounds);
+}
+
+MetricLatency& MetricRegistry::Latency(const Utf8String& name, const Utf8String& help, const MetricLabels& labels)
+{
+	return this->Get<MetricLatency>(MetricType::Summary, name, help, labels);
+}
+
+Utf8String MetricRegistry::Render() const
+{
+	static constexpr const char* Types[] = { "counter", "gauge", "histogram", "summary" };
+
+	Utf8String out;
+
+	const std::lock_guard<std::mutex> lock(mLock);
+
+	for (auto& [name, family] : mFamilies)
+	{
+		out.append("# HELP ").append(name).append(" ").append(family.Help).append("\n");
+		out.append("# TYPE ").append(name).append(" ").append(Types[(int)family.Type]).append("\n");
+
+		for (auto& [labels, metric] : family.Series)
+		{
+			metric->Render(out, name, labels);
+		}
+	}
+
+	return out;
+}
+
+Utf8String HandleMetricsRequest(std::string_view request)
+{
+	// only the request line matters, "GET /metrics HTTP/1.1"
+	auto line = request.substr(0, request.find("\r\n"));
+
+	auto method = line.substr(0, line.find(' '));
+	auto target = line.size() > method.size() ? line.substr(method.size() + 1) : std::string_view();
+	target = target.substr(0, target.find(' '));
+	target = target.substr(0, target.find('?'));
+
+	Utf8String status = "200 OK";
+	Utf8String body;
+
+	if (method != "GET" && method != "HEAD")
+	{
+		status = "405 Method Not Allowed";
+	}
+	else if (target != "/metrics")
+	{
+		status = "404 Not Found";
+	}
+	else
+	{
+		body = GetMetrics().Render();
+	}
+
+	Utf8String response = "HTTP/1.0 " + status + "\r\n";
+	response.append("Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n");
+	response.append("Content-Length: ").append(std::to_string(body.size())).append("\r\n");
+	response.append("Connection: close\r\n\r\n");
+
+	if (method != "HEAD")
+	{
+		response.append(body);
+	}
+
+	return response;
+}
@@ -0,0 +1,202 @@
+// Author: Martin Wetzko
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "Env.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// name and value pairs, rendered in the given order
+using MetricLabels = std::vector<std::pair<Utf8String, Utf8String>>;
+
+class Metric
+{
+public:
+	virtual ~Metric() = default;
+
+	virtual void Render(Utf8String&, const Utf8String&, const Utf8String&) const = 0;
+};
+
+class MetricCounter : public Metric
+{
+private:
+	std::atomic<std::uint64_t> mValue = 0;
+
+public:
+	void Increment(std::uint64_t value = 1)
+	{
+		mValue.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	std::uint64_t Get() const
+	{
+		return mValue.load(std::memory_order_relaxed);
+	}
+
+	void Render(Utf8String&, const Utf8String&, const Utf8String&) const override;
+};
+
+class MetricGauge : public Metric
+{
+private:
+	std::atomic<double> mValue = 0.0;
+
+public:
+	void Set(double value)
+	{
+		mValue.store(value, std::memory_order_relaxed);
+	}
+
+	void Add(double value)
+	{
+		mValue.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	double Get() const
+	{
+		return mValue.load(std::memory_order_relaxed);
+	}
+
+	void Render(Utf8String&, const Utf8String&, const Utf8String&) const override;
+};
+
+// fixed upper bounds, every bucket counts only its own range and is summed up when rendered
+class MetricHistogram : public Metric
+{
+private:
+	std::vector<double> mBounds;
+	std::unique_ptr<std::atomic<std::uint64_t>[]> mBuckets;
+	std::atomic<double> mSum = 0.0;
+	std::atomic<std::uint64_t> mCount = 0;
+
+public:
+	MetricHistogram(const std::vector<double>&);
+
+	void Observe(double value)
+	{
+		size_t i = std::lower_bound(mBounds.begin(), mBounds.end(), value) - mBounds.begin();
+
+		// the last bucket is +Inf
+		mBuckets[i].fetch_add(1, std::memory_order_relaxed);
+		mSum.fetch_add(value, std::memory_order_relaxed);
+		mCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void Render(Utf8String&, const Utf8String&, const Utf8String&) const override;
+};
+
+// durations in log-linear buckets like an hdr histogram, about 3% relative error from 1us to 12 days,
+// rendered as a summary with a few quantiles
+class MetricLatency : public Metric
+{
+public:
+	static constexpr int SubBucketBits = 5;
+	static constexpr int MaxValueBits = 40;
+	static constexpr size_t BucketCount = (MaxValueBits - SubBucketBits + 2) << (SubBucketBits - 1);
+
+private:
+	std::unique_ptr<std::atomic<std::uint64_t>[]> mBuckets;
+	std::atomic<std::uint64_t> mSum = 0;
+	std::atomic<std::uint64_t> mCount = 0;
+	std::atomic<std::uint64_t> mMax = 0;
+
+	static size_t GetBucket(std::uint64_t value)
+	{
+		int shift = std::max<int>((int)std::bit_width(value) - SubBucketBits, 0);
+
+		return ((size_t)shift << (SubBucketBits - 1)) + (size_t)(value >> shift);
+	}
+
+public:
+	MetricLatency();
+
+	void Record(std::chrono::steady_clock::duration duration)
+	{
+		auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+		auto value = std::min<std::uint64_t>(us < 0 ? 0 : (std::uint64_t)us, ((std::uint64_t)1 << MaxValueBits) - 1);
+
+		mBuckets[GetBucket(value)].fetch_add(1, std::memory_order_relaxed);
+		mSum.fetch_add(value, std::memory_order_relaxed);
+		mCount.fetch_add(1, std::memory_order_relaxed);
+
+		auto max = mMax.load(std::memory_order_relaxed);
+
+		while (value > max && !mMax.compare_exchange_weak(max, value, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	std::uint64_t GetCount() const
+	{
+		return mCount.load(std::memory_order_relaxed);
+	}
+
+	std::chrono::microseconds GetMax() const
+	{
+		return std::chrono::microseconds(mMax.load(std::memory_order_relaxed));
+	}
+
+	// the highest value in the bucket holding the quantile, never more than the maximum
+	std::chrono::microseconds GetQuantile(double) const;
+
+	void Render(Utf8String&, const Utf8String&, const Utf8String&) const override;
+};
+
+// metrics are looked up once and kept, updating them never locks, only registering and rendering do
+class MetricRegistry
+{
+private:
+	enum class MetricType
+	{
+		Counter,
+		Gauge,
+		Histogram,
+		Summary
+	};
+
+	struct MetricFamily
+	{
+		Utf8String Help;
+		MetricType Type;
+		std::map<Utf8String, std::unique_ptr<Metric>> Series;
+	};
+
+	std::map<Utf8String, MetricFamily> mFamilies;
+	mutable std::mutex mLock;
+
+	template<typename T, typename... Args>
+	T& Get(MetricType, const Utf8String&, const Utf8String&, const MetricLabels&, Args&&...);
+
+public:
+	// the same name and labels always return the same metric, the reference stays valid
+	MetricCounter& Counter(const Utf8String&, const Utf8String&, const MetricLabels& = {});
+	MetricGauge& Gauge(const Utf8String&, const Utf8String&, const MetricLabels& = {});
+	MetricHistogram& Histogram(const Utf8String&, const Utf8String&, const std::vector<double>&, const MetricLabels& = {});
+	MetricLatency& Latency(const Utf8String&, const Utf8String&, const MetricLabels& = {});
+
+	// prometheus text format 0.0.4
+	Utf8String Render() const;
+};
+
+// created on first use, metrics may be registered during static initialization
+MetricRegistry& GetMetrics();
+
+// answers a complete http request for the metrics with a complete response
+Utf8String HandleMetricsRequest(std::string_view);
+
+// serves the metrics on a local port until the exit event, false if not available
+bool StartMetricsServer(const Utf8String&, std::uint16_t);
+void StopMetricsServer();
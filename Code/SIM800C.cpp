@@ -9,6 +9,7 @@
 
 #include "SIM800C.h"
 #include "GsmDecoder.h"
+#include "Metrics.h"
 
 SIM800C::SIM800C()
 {
@@ -20,42 +21,118 @@ SIM800C::SIM800C(const std::filesystem::path& root, const PlatformString& port,
 	mRoot = root;
 	mPort = port;
 	mSerial = serial;
-	mRecentCaller = PLATFORMSTR("");
+	mRecentCaller = "";
 	mRecentCallerTime = std::chrono::steady_clock::now();
+	mLastActivity = mRecentCallerTime;
+
+	MetricLabels labels = { { "modem", PlatformStringToUtf8(port) } };
+
+	mSmsReceived = &GetMetrics().Counter("smsrouter_sms_received_total", "Messages handed on for delivery, concatenated ones count once.", labels);
+	mSmsParseFailures = &GetMetrics().Counter("smsrouter_sms_parse_failures_total", "PDUs that could not be decoded and were forwarded raw.", labels);
+	mCalls = &GetMetrics().Counter("smsrouter_calls_total", "Calls forwarded, repeated caller IDs of one call count once.", labels);
+	mCallsDeduplicated = &GetMetrics().Counter("smsrouter_calls_deduplicated_total", "Repeated caller IDs of the same call that were not forwarded.", labels);
+	mNetworkState = &GetMetrics().Gauge("smsrouter_network_registration_state", "Last +CREG state, 0 not registered, 1 home, 2 searching, 3 denied, 4 unknown, 5 roaming.", labels);
 }
 
-bool SIM800C::WriteLine(const PlatformString& cmd)
+bool SIM800C::WriteLine(const Utf8String& cmd)
 {
-	Utf8String str = PlatformStringToUtf8(cmd);
+	this->OutputDebug(PLATFORMSTR("> "), cmd);
 
-	return mSerial->WriteLine(str);
+	return mSerial->WriteLine(cmd);
 }
 
-bool SIM800C::ReadLine(PlatformString* line)
+bool SIM800C::ReadLine(std::string_view* line)
 {
-	Utf8String str;
-	if (mSerial->ReadLine(&str))
-	{
-		line->assign(Utf8ToPlatformString(str));
-		return true;
-	}
-	return false;
+	return mSerial->ReadLine(line);
 }
 
-bool SIM800C::ProcessCache()
+void SIM800C::ProcessCache()
 {
-	auto sc = mSmsCache.begin();
+	// the whole listing in one pass, deleted with as few commands as possible afterwards
+	std::vector<int> stored;
+	bool complete = true;
+
+	// a listing without +CMTI before is counted from here
+	auto now = std::chrono::steady_clock::now();
+
+	mSmsTrace.Indicated = mSmsIndicated != std::chrono::steady_clock::time_point() ? mSmsIndicated : now;
+	mSmsTrace.Listed = now;
+	mSmsIndicated = std::chrono::steady_clock::time_point();
 
-	while (sc != mSmsCache.end())
+	for (auto& item : mSmsCache)
 	{
-		if (!ProcessSms(sc->Command, sc->PDU))
+		if (!this->ProcessSms(item.Command, item.PDU, &stored))
 		{
-			return false;
+			complete = false;
 		}
+	}
+
+	mSmsCache.clear();
+
+	// parts waiting for the rest of their message are marked read as well, the bulk form would delete them
+	this->CommitSms(stored, complete && mReassembler.GetCount() == 0);
+}
+
+void SIM800C::CommitSms(const std::vector<int>& stored, bool all)
+{
+	if (stored.empty())
+	{
+		return;
+	}
+
+	if (this->OnCommitSms && !this->OnCommitSms(*this))
+	{
+		// better to see them again than to lose them
+		this->OutputConsole(PLATFORMSTR("SMS could not be stored, keeping them on the SIM card"));
+		return;
+	}
+
+	this->DeleteSms(stored, all);
+}
+
+void SIM800C::DeleteSms(const std::vector<int>& indices, bool all)
+{
+	// listing marks every message read, so the bulk form only fits if every one of them was stored
+	if (all && mBulkDelete)
+	{
+		this->QueueCommandNext("AT+CMGD=" + std::to_string(indices.front()) + ",1", [indices](SIM800C& sim, bool ok, const Utf8String&)
+			{
+				if (!ok)
+				{
+					sim.OutputConsole(PLATFORMSTR("CMGD (Delete read SMS) is not supported, deleting one by one"));
+
+					sim.mBulkDelete = false;
+					sim.DeleteSms(indices, false);
+				}
+
+				return true;
+			});
 
-		sc = mSmsCache.erase(sc);
+		return;
 	}
 
+	// one after the other in front of everything else, each one queues the next
+	std::vector<int> remaining(indices.begin() + 1, indices.end());
+
+	this->QueueCommandNext("AT+CMGD=" + std::to_string(indices.front()), [remaining](SIM800C& sim, bool ok, const Utf8String&)
+		{
+			if (!ok)
+			{
+				sim.OutputConsole(PLATFORMSTR("CMGD (Delete SMS) command failed!"));
+				return false;
+			}
+
+			if (remaining.size() > 0)
+			{
+				sim.DeleteSms(remaining, false);
+			}
+
+			return true;
+		});
+}
+
+void SIM800C::ProcessCallerCache()
+{
 	auto cc = mCallerCache.begin();
 
 	while (cc != mCallerCache.end())
@@ -67,112 +144,170 @@ bool SIM800C::ProcessCache()
 
 		cc = mCallerCache.erase(cc);
 	}
-
-	return true;
 }
 
-bool SIM800C::IsOKCommand(const PlatformString& line)
+bool SIM800C::IsOKCommand(std::string_view line)
 {
-	return Equal(PlatformString(PLATFORMSTR("OK")), line);
+	return line == "OK";
 }
 
-bool SIM800C::IsErrorCommand(const PlatformString& line)
+bool SIM800C::IsErrorCommand(std::string_view line)
 {
-	return Equal(PlatformString(PLATFORMSTR("ERROR")), line);
+	return line == "ERROR";
 }
 
-bool SIM800C::IsOKOrErrorCommand(const PlatformString& line)
+bool SIM800C::IsOKOrErrorCommand(std::string_view line)
 {
 	return this->IsOKCommand(line) || this->IsErrorCommand(line);
 }
 
-bool SIM800C::ExecuteATCommand(const PlatformString& cmd)
+void SIM800C::QueueCommand(const Utf8String& cmd, const PlatformString& failure)
+{
+	this->QueueCommand(cmd, [failure](SIM800C& sim, bool ok, const Utf8String&)
+		{
+			if (!ok)
+			{
+				sim.OutputConsole(failure);
+			}
+
+			return ok;
+		});
+}
+
+void SIM800C::QueueCommand(const Utf8String& cmd, const CommandHandler& handler, bool captureReturn)
+{
+	mCommands.push_back({ cmd, handler, captureReturn });
+
+	this->SendNextCommand();
+}
+
+void SIM800C::QueueCommandNext(const Utf8String& cmd, const CommandHandler& handler, bool captureReturn)
 {
-	return this->ExecuteATCommand(cmd, NULL);
+	mCommands.insert(mCommands.begin() + (mCommandSent ? 1 : 0), { cmd, handler, captureReturn });
+
+	this->SendNextCommand();
 }
 
-bool SIM800C::ExecuteATCommand(const PlatformString& cmd, PlatformString* ret)
+void SIM800C::SendNextCommand()
 {
-	if (!this->WriteLine(cmd))
+	if (mCommandSent || mCommands.empty() || mState == DeviceState::Failed)
 	{
-		return false;
+		return;
 	}
 
-	while (true)
+	mCommandSent = true;
+	mCommandReturn = "";
+	mLastActivity = std::chrono::steady_clock::now();
+
+	if (!this->WriteLine(mCommands.front().Command))
 	{
-		PlatformString line;
-		if (!this->ReadLine(&line))
-		{
-			if (ret && *ret != PLATFORMSTR(""))
-			{
-				this->OutputConsole(PLATFORMSTR("Unhandled return: "), *ret);
-			}
+		this->CompleteCommand(false);
+	}
+}
 
-			return false;
-		}
+void SIM800C::CompleteCommand(bool ok)
+{
+	auto item = mCommands.front();
+	auto ret = mCommandReturn;
 
-		if (line == PLATFORMSTR("") || line == cmd)
-		{
-			continue;
-		}
+	mCommands.pop_front();
+	mCommandSent = false;
+	mCommandReturn = "";
 
-		std::wsmatch match;
-		if (std::regex_search(line, match, mRegMatchATResult))
-		{
-			this->OnCommand(match.str(1), match.suffix());
-		}
-		else if (line == PLATFORMSTR("OK"))
-		{
-			return true;
-		}
-		else if (line == PLATFORMSTR("ERROR"))
-		{
-			if (ret && *ret != PLATFORMSTR(""))
-			{
-				this->OutputConsole(PLATFORMSTR("Unhandled return: "), *ret);
-			}
+	if (!ok && ret != "")
+	{
+		this->OutputConsole(PLATFORMSTR("Unhandled return: "), ret);
+	}
 
-			return false;
-		}
-		else
-		{
-			if (ret)
+	if (item.OnDone && !item.OnDone(*this, ok, ret))
+	{
+		this->Fail();
+		return;
+	}
+
+	this->SendNextCommand();
+}
+
+void SIM800C::Fail()
+{
+	mState = DeviceState::Failed;
+	mCommands.clear();
+	mCommandSent = false;
+}
+
+void SIM800C::Poll()
+{
+	if (mState != DeviceState::Ready || mCommandSent || !mCommands.empty())
+	{
+		return;
+	}
+
+	this->ProcessCallerCache();
+
+	if (mReassembler.GetCount() > 0)
+	{
+		std::vector<SmsReassembler::Message> expired;
+		std::vector<int> stored;
+
+		mReassembler.Expire(std::chrono::steady_clock::now(), &expired);
+
+		// waited for parts that never came, nothing worth measuring
+		mSmsTrace = SmsTrace();
+
+		this->DeliverSms(expired, &stored);
+		this->CommitSms(stored, false);
+	}
+
+	if (mNeedCheckSms)
+	{
+		mNeedCheckSms = false;
+
+		this->QueueCommand("AT+CMGL=4", [](SIM800C& sim, bool ok, const Utf8String&)
 			{
-				if (*ret != PLATFORMSTR(""))
+				if (!ok)
 				{
-					this->OutputConsole(PLATFORMSTR("Unhandled return: "), *ret);
+					sim.OutputConsole(PLATFORMSTR("CMGL (List SMS) command failed!"));
+					return false;
 				}
 
-				*ret = line;
-			}
-			else
-			{
-				this->OutputConsole(PLATFORMSTR("Unhandled return: "), line);
-			}
-		}
+				sim.ProcessCache();
+
+				return true;
+			});
 	}
 }
 
-void SIM800C::PrintNetworkState(const PlatformString& value)
+void SIM800C::PrintNetworkState(std::string_view value)
 {
 	auto state = value;
 
-	auto pos = state.find(PLATFORMSTR(','));
+	// "<n>,<stat>" answers the query, the unsolicited form only has the state
+	if (mState == DeviceState::Initializing && state.find(',') != std::string_view::npos)
+	{
+		this->OnSetting("+CREG", value);
+	}
 
-	if (pos != PlatformString::npos)
+	auto pos = state.find(',');
+
+	if (pos != std::string_view::npos)
 	{
 		state = state.substr(pos + 1);
 	}
 
-	if (Equal(PlatformString(PLATFORMSTR("0")), state))
+	if (state.size() == 1 && state[0] >= '0' && state[0] <= '9')
+	{
+		mNetworkState->Set(state[0] - '0');
+	}
+
+	if (state == "0")
 	{
 		this->OutputConsole(PLATFORMSTR("Network state change: Disconnected"));
 	}
-	else if (Equal(PlatformString(PLATFORMSTR("1")), state))
+	else if (state == "1")
 	{
 		this->OutputConsole(PLATFORMSTR("Network state change: Connected"));
 	}
-	else if (Equal(PlatformString(PLATFORMSTR("2")), state))
+	else if (state == "2")
 	{
 		this->OutputConsole(PLATFORMSTR("Network state change: Searching..."));
 	}
@@ -183,289 +318,882 @@ void SIM800C::PrintNetworkState(const PlatformString& value)
 	}
 }
 
-void SIM800C::OnCommand(const PlatformString& cmd, const PlatformString& value)
+void SIM800C::OnPinState(std::string_view value)
 {
-	if (cmd == PLATFORMSTR("+CPIN"))
-	{
-		mStore[cmd] = value;
-	}
-	else if (cmd == PLATFORMSTR("+CNUM"))
+	mStore["+CPIN"] = value;
+}
+
+void SIM800C::OnSubscriberNumberResult(std::string_view value)
+{
+	std::cmatch match;
+	if (std::regex_search(value.data(), value.data() + value.size(), match, mRegMatchSubscriberNumber))
 	{
-		std::wsmatch match;
-		if (std::regex_search(value, match, mRegMatchSubscriberNumber))
-		{
-			mStore[cmd] = match.str(3);
-		}
+		mStore["+CNUM"] = match.str(3);
 	}
-	else if (cmd == PLATFORMSTR("+CMGL"))
-	{
-		this->OutputConsole(PLATFORMSTR("New SMS!"));
+}
 
-		PlatformString line;
-		if (!this->ReadLine(&line))
-		{
-			return;
-		}
+void SIM800C::OnSmsListEntry(std::string_view value)
+{
+	this->OutputConsole(PLATFORMSTR("New SMS!"));
 
-		mSmsCache.push_back({ value, line });
-	}
-	else if (cmd == PLATFORMSTR("+CREG"))
-	{
-		PrintNetworkState(value);
-	}
-	else if (cmd == PLATFORMSTR("+CMTI"))
+	// the PDU follows on the next line
+	mPendingSms = value;
+	mNeedSmsPdu = true;
+}
+
+void SIM800C::OnSmsIndication(std::string_view)
+{
+	// the first one counts, more may arrive before the listing
+	if (mSmsIndicated == std::chrono::steady_clock::time_point())
 	{
-		mNeedCheckSms = true;
+		mSmsIndicated = std::chrono::steady_clock::now();
 	}
-	else if (cmd == PLATFORMSTR("+CRING"))
+
+	mNeedCheckSms = true;
+}
+
+void SIM800C::OnRing(std::string_view value)
+{
+	this->OutputConsole(PLATFORMSTR("Incoming call: "), value);
+}
+
+void SIM800C::OnCallerId(std::string_view value)
+{
+	if (value.size() > 0 && value[0] >= '0' && value[0] <= '9')
 	{
-		this->OutputConsole(PLATFORMSTR("Incoming call: "), value);
+		// "<n>,<m>" answers the query, caller IDs are quoted
+		this->OnSetting("+CLIP", value);
+		return;
 	}
-	else if (cmd == PLATFORMSTR("+CLIP"))
-	{
-		std::wsmatch match;
-		if (std::regex_search(value, match, mRegMatchCallerId))
-		{
-			auto caller = match.str(1);
-			auto now = std::chrono::steady_clock::now();
 
-			if (mRecentCaller != caller || std::chrono::duration_cast<std::chrono::seconds>(now - mRecentCallerTime).count() > 60)
-			{
-				std::time_t t = std::time(nullptr);
-				std::tm* tx = localtime(&t);
+	std::cmatch match;
+	if (std::regex_search(value.data(), value.data() + value.size(), match, mRegMatchCallerId))
+	{
+		auto caller = match.str(1);
+		auto now = std::chrono::steady_clock::now();
 
-				PlatformStream strm;
+		if (mRecentCaller != caller || std::chrono::duration_cast<std::chrono::seconds>(now - mRecentCallerTime).count() > 60)
+		{
+			std::time_t t = std::time(nullptr);
+			std::tm* tx = localtime(&t);
 
-				strm << std::put_time(tx, PLATFORMSTR("%FT%T%z"));
+			std::stringstream strm;
 
-				mCallerCache.push_back({ caller, strm.str() });
-			}
+			strm << std::put_time(tx, "%FT%T%z");
 
-			mRecentCaller = caller;
-			mRecentCallerTime = now;
+			mCallerCache.push_back({ caller, strm.str() });
 
-			this->OutputConsole(PLATFORMSTR("Caller ID: "), caller);
+			mCalls->Increment();
 		}
 		else
 		{
-			// must never happen
-			this->OutputConsole(PLATFORMSTR("Caller ID: "), value);
+			// every ring repeats the caller ID
+			mCallsDeduplicated->Increment();
 		}
+
+		mRecentCaller = caller;
+		mRecentCallerTime = now;
+
+		this->OutputConsole(PLATFORMSTR("Caller ID: "), caller);
 	}
 	else
 	{
-		this->OutputConsole(PLATFORMSTR("Unhandled command: "), cmd, PLATFORMSTR(" with value: "), value);
+		// must never happen
+		this->OutputConsole(PLATFORMSTR("Caller ID: "), value);
 	}
 }
 
-bool SIM800C::ProcessSms(const PlatformString& cmd, const PlatformString& pdu)
+// static configuration, written to the modem profile with AT&W and only verified on later starts
+struct SIM800CProfileSetting
 {
-	std::wsmatch match;
-	if (!std::regex_search(cmd, match, mRegMatchSmsIndex))
-	{
-		// ignore this one
-		return true;
-	}
+	std::string_view Code;
+	std::string_view Value;
+};
 
-	int index = std::stoi(match.str(1));
+static constexpr SIM800CProfileSetting SIM800CProfile[] =
+{
+	{ "+CMGF", "0" },
+	{ "+CRC", "1" },
+	{ "+CREG", "1" },
+	{ "+CLIP", "1" },
+	{ "+CNMI", "2" },
+};
+
+// joins commands without their "AT" into one line, extended commands need a ';' behind them
+Utf8String ConcatCommands(const std::vector<Utf8String>& commands)
+{
+	Utf8String line = "AT";
 
-	PlatformString from;
-	PlatformString datetime;
-	PlatformString message;
-	if (ParseGsmPDU(pdu, &from, &datetime, &message))
+	for (size_t i = 0; i < commands.size(); i++)
 	{
-		if (this->OnNewSms)
+		line.append(commands[i]);
+
+		if (i + 1 < commands.size() && commands[i].starts_with("+"))
 		{
-			this->OnNewSms(*this, from, datetime, message);
+			line.append(";");
 		}
 	}
-	else
+
+	return line;
+}
+
+struct SIM800CResultHandler
+{
+	std::string_view Code;
+	void (SIM800C::* Handler)(std::string_view);
+};
+
+constexpr size_t ResultHash(std::string_view code)
+{
+	size_t hash = 0;
+
+	for (auto c : code)
 	{
-		if (this->OnNewSms)
+		hash = hash * 31 + (byte)c;
+	}
+
+	return hash & 31;
+}
+
+struct SIM800CResultHandlers
+{
+	// a new result code or URC only needs an entry here
+	static constexpr SIM800CResultHandler Table[] =
+	{
+		{ "+CPIN", &SIM800C::OnPinState },
+		{ "+CNUM", &SIM800C::OnSubscriberNumberResult },
+		{ "+CMGL", &SIM800C::OnSmsListEntry },
+		{ "+CREG", &SIM800C::PrintNetworkState },
+		{ "+CMTI", &SIM800C::OnSmsIndication },
+		{ "+CRING", &SIM800C::OnRing },
+		{ "+CLIP", &SIM800C::OnCallerId },
+		{ "+CMGF", &SIM800C::OnMessageFormat },
+		{ "+CRC", &SIM800C::OnRingFormat },
+		{ "+CNMI", &SIM800C::OnSmsNotification },
+		{ "+IPR", &SIM800C::OnLinkSpeeds },
+	};
+
+	static constexpr std::array<int, 32> Slots = []()
 		{
-			this->OnNewSms(*this, PLATFORMSTR("FAILED TO PARSE"), PLATFORMSTR(""), pdu);
+			std::array<int, 32> slots;
+
+			slots.fill(-1);
+
+			for (int i = 0; i < (int)std::size(Table); i++)
+			{
+				auto& slot = slots[ResultHash(Table[i].Code)];
+
+				// collision, the hash needs another multiplier
+				slot = slot < 0 ? i : 64;
+			}
+
+			return slots;
+		}();
+
+	static_assert(std::find(Slots.begin(), Slots.end(), 64) == Slots.end(), "ResultHash is not perfect for the result table");
+
+	static const SIM800CResultHandler* Find(std::string_view code)
+	{
+		int index = Slots[ResultHash(code)];
+
+		if (index < 0 || Table[index].Code != code)
+		{
+			return nullptr;
 		}
+
+		return &Table[index];
 	}
+};
 
-	if (!this->ExecuteATCommand(FormatStr(PLATFORMSTR("AT+CMGD=%i"), index)))
+bool SIM800C::ParseResult(std::string_view line, std::string_view* code, std::string_view* value)
+{
+	// "+CODE:" followed by at least one blank, code is alphanumeric
+	if (line.size() < 3 || line[0] != '+')
 	{
-		this->OutputConsole(PLATFORMSTR("CMGD (Delete SMS) command failed!"));
 		return false;
 	}
 
-	return true;
-}
+	size_t pos = 1;
 
-bool SIM800C::Init()
-{
-	if (!this->ExecuteATCommand(PLATFORMSTR("AT")))
+	while (pos < line.size() && ((line[pos] >= '0' && line[pos] <= '9') || (line[pos] >= 'A' && line[pos] <= 'Z') || (line[pos] >= 'a' && line[pos] <= 'z')))
 	{
-		this->OutputConsole(PLATFORMSTR("AT start command failed!"));
-		return false;
+		pos++;
 	}
 
-	if (!this->ExecuteATCommand(PLATFORMSTR("ATE0")))
+	if (pos == 1 || pos + 1 >= line.size() || line[pos] != ':' || (line[pos + 1] != ' ' && line[pos + 1] != '\t'))
 	{
-		this->OutputConsole(PLATFORMSTR("ATE start command failed!"));
 		return false;
 	}
 
-	if (!this->ExecuteATCommand(PLATFORMSTR("AT+CPIN?")))
+	*code = line.substr(0, pos);
+
+	pos += 2;
+
+	while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t'))
 	{
-		this->OutputConsole(PLATFORMSTR("PIN command failed!"));
-		return false;
+		pos++;
 	}
 
-	if (mStore[PLATFORMSTR("+CPIN")] != PLATFORMSTR("READY"))
+	*value = line.substr(pos);
+
+	return true;
+}
+
+void SIM800C::OnCommand(std::string_view cmd, std::string_view value)
+{
+	auto handler = SIM800CResultHandlers::Find(cmd);
+
+	if (handler)
 	{
-		this->OutputConsole(PLATFORMSTR("SIM card requires a PIN. Remove the PIN and try again!"));
-		return false;
+		(this->*handler->Handler)(value);
+	}
+	else
+	{
+		this->OutputConsole(PLATFORMSTR("Unhandled command: "), cmd, PLATFORMSTR(" with value: "), value);
 	}
+}
 
-	if (!this->ExecuteATCommand(PLATFORMSTR("AT+CMGF=0")))
+// the indices of what got stored are appended, a part held back for its message is neither stored nor failed
+bool SIM800C::ProcessSms(const Utf8String& cmd, const Utf8String& pdu, std::vector<int>* stored)
+{
+	std::smatch match;
+	if (!std::regex_search(cmd, match, mRegMatchSmsIndex))
 	{
-		this->OutputConsole(PLATFORMSTR("Set PDU mode command failed!"));
+		// ignore this one
 		return false;
 	}
 
-	if (!this->ExecuteATCommand(PLATFORMSTR("AT+CRC=1")))
+	int index = std::stoi(match.str(1));
+
+	Utf8String from;
+	Utf8String datetime;
+	Utf8String message;
+	GsmConcatInfo concat;
+	bool parsed = ParseGsmPDU(pdu, &from, &datetime, &message, &concat);
+
+	mSmsTrace.Parsed = std::chrono::steady_clock::now();
+
+	if (parsed)
 	{
-		this->OutputConsole(PLATFORMSTR("Set extended ring mode command failed!"));
-		return false;
+		std::vector<SmsReassembler::Message> ready;
+
+		mReassembler.Add(from, datetime, concat, message, index, &ready);
+
+		return this->DeliverSms(ready, stored);
 	}
 
-	if (!this->ExecuteATCommand(PLATFORMSTR("AT+CNUM")))
+	mSmsParseFailures->Increment();
+
+	if (this->OnNewSms && !this->OnNewSms(*this, "FAILED TO PARSE", "", pdu, false))
 	{
-		this->OutputConsole(PLATFORMSTR("Get own number command failed!"));
 		return false;
 	}
 
-	auto number = this->GetSubscriberNumber();
+	stored->push_back(index);
 
-	if (number == PLATFORMSTR(""))
+	return true;
+}
+
+bool SIM800C::DeliverSms(const std::vector<SmsReassembler::Message>& messages, std::vector<int>* stored)
+{
+	bool ok = true;
+
+	for (auto& message : messages)
 	{
-		this->OutputConsole(PLATFORMSTR("Subscriber number is empty! Get CCID..."));
+		mSmsReceived->Increment();
 
-		if (!this->ExecuteATCommand(PLATFORMSTR("AT+CCID"), &number))
+		if (this->OnNewSms && !this->OnNewSms(*this, message.From, message.DateTime, message.Text, message.Partial))
 		{
-			this->OutputConsole(PLATFORMSTR("Get CCID command failed!"));
-			return false;
+			ok = false;
+			continue;
 		}
 
-		if (number == PLATFORMSTR(""))
-		{
-			this->OutputConsole(PLATFORMSTR("CCID is empty!"));
-			return false;
-		}
+		stored->insert(stored->end(), message.Indices.begin(), message.Indices.end());
+	}
 
-		auto mapfile = PlatformString(number).append(PLATFORMSTR(".number"));
+	return ok;
+}
 
-		this->OutputConsole(PLATFORMSTR("Looking for number mapping file "), mapfile);
+void SIM800C::OnSubscriberNumber(Utf8String number)
+{
+	if (number == "")
+	{
+		this->OutputConsole(PLATFORMSTR("Subscriber number is empty! Get CCID..."));
 
-		auto path = mRoot / mapfile;
+		this->QueueCommandNext("AT+CCID", [](SIM800C& sim, bool ok, const Utf8String& ret)
+			{
+				if (!ok)
+				{
+					sim.OutputConsole(PLATFORMSTR("Get CCID command failed!"));
+					return false;
+				}
 
-		PlatformString numbermap;
-		if (!ReadAllText(path, numbermap) || numbermap == PLATFORMSTR(""))
-		{
-			number = (PlatformString(PLATFORMSTR("SIM-")).append(number));
-		}
-		else
-		{
-			number = numbermap;
-		}
+				if (ret == "")
+				{
+					sim.OutputConsole(PLATFORMSTR("CCID is empty!"));
+					return false;
+				}
+
+				auto mapfile = Utf8String(ret).append(".number");
+
+				sim.OutputConsole(PLATFORMSTR("Looking for number mapping file "), mapfile);
+
+				auto path = sim.mRoot / mapfile;
+
+				Utf8String numbermap;
+				if (!ReadAllText(path, numbermap) || numbermap == "")
+				{
+					sim.OnSubscriberNumber(Utf8String("SIM-").append(ret));
+				}
+				else
+				{
+					sim.OnSubscriberNumber(numbermap);
+				}
+
+				return true;
+			}, true);
+
+		return;
 	}
 
 	this->OutputConsole(PLATFORMSTR("Phone number is "), number);
 
 	this->OutputConsole(PLATFORMSTR("Processing SMS on SIM card..."));
+}
+
+void SIM800C::SetLinkOptions(std::uint32_t maxSpeed, bool flowControl)
+{
+	mMaxLinkSpeed = maxSpeed;
+	mWantFlowControl = flowControl;
+}
+
+// per usb device, the port name goes to whatever modem is plugged in first
+std::filesystem::path SIM800C::GetLinkFile() const
+{
+	return mRoot / std::filesystem::path(GetPortIdentity(mPort)).concat(".link");
+}
 
-	if (!this->ExecuteATCommand(PLATFORMSTR("AT+CMGL=4")))
+void SIM800C::LoadLinkSpeed()
+{
+	// "115200" or "115200 rtscts"
+	Utf8String link;
+	if (!ReadAllText(this->GetLinkFile(), link) || link == "")
 	{
-		this->OutputConsole(PLATFORMSTR("CMGL (List SMS) command failed!"));
-		return false;
+		return;
 	}
 
-	if (!this->ProcessCache())
+	std::istringstream strm(link);
+
+	std::uint32_t speed = 0;
+	Utf8String flow;
+	strm >> speed >> flow;
+
+	if (speed != 0 && !this->SwitchLinkSpeed(speed, flow == "rtscts"))
 	{
-		return false;
+		this->OutputConsole(PLATFORMSTR("Ignoring remembered link speed "), link);
 	}
+}
+
+void SIM800C::SaveLinkSpeed()
+{
+	auto link = std::to_string(mLinkSpeed);
 
-	if (!this->ExecuteATCommand(PLATFORMSTR("AT+CREG=1")))
+	if (mLinkFlowControl)
 	{
-		this->OutputConsole(PLATFORMSTR("Enable network registration status notification failed!"));
-		return false;
+		link.append(" rtscts");
 	}
 
-	if (!this->ExecuteATCommand(PLATFORMSTR("AT+CLIP=1")))
+	if (!WriteAllText(this->GetLinkFile(), link))
 	{
-		this->OutputConsole(PLATFORMSTR("Enable caller identification notification failed!"));
-		return false;
+		this->OutputConsole(PLATFORMSTR("Unable to remember the link speed!"));
 	}
+}
 
-	if (!this->ExecuteATCommand(PLATFORMSTR("AT+CNMI=2")))
+bool SIM800C::SwitchLinkSpeed(std::uint32_t speed, bool flowControl)
+{
+	if (!mSerial->SupportsLinkSpeed(speed) || !mSerial->SetLinkSpeed(speed, flowControl))
 	{
-		this->OutputConsole(PLATFORMSTR("Enable SMS notification failed!"));
 		return false;
 	}
 
-	if (!this->ExecuteATCommand(PLATFORMSTR("AT+CREG?")))
+	mLinkSpeed = speed;
+	mLinkFlowControl = flowControl;
+
+	return true;
+}
+
+void SIM800C::ProbeLink()
+{
+	this->QueueCommandNext("AT", [](SIM800C& sim, bool ok, const Utf8String&)
+		{
+			if (ok)
+			{
+				// found by scanning, the next start goes there right away
+				if (sim.mLinkTried.size() > 1)
+				{
+					sim.SaveLinkSpeed();
+				}
+
+				sim.TuneLink();
+				return true;
+			}
+
+			if (!sim.ScanLink())
+			{
+				sim.OutputConsole(PLATFORMSTR("AT start command failed!"));
+				return false;
+			}
+
+			return true;
+		});
+}
+
+// switches to the next rate not tried yet and probes it, false once every rate failed
+bool SIM800C::ScanLink()
+{
+	auto failed = mLinkSpeed;
+
+	if (std::find(mLinkTried.begin(), mLinkTried.end(), failed) == mLinkTried.end())
 	{
-		this->OutputConsole(PLATFORMSTR("Get network registration status failed!"));
-		return false;
+		mLinkTried.push_back(failed);
 	}
 
-	return true;
+	for (auto rate : ScanLinkSpeeds)
+	{
+		if (std::find(mLinkTried.begin(), mLinkTried.end(), rate) != mLinkTried.end() || !this->SwitchLinkSpeed(rate, false))
+		{
+			continue;
+		}
+
+		mLinkTried.push_back(rate);
+
+		this->OutputConsole(PLATFORMSTR("No answer at "), failed, PLATFORMSTR(" baud, trying "), rate, PLATFORMSTR(" baud..."));
+
+		this->ProbeLink();
+
+		return true;
+	}
+
+	return false;
 }
 
-bool SIM800C::PerformLoop()
+void SIM800C::TuneLink()
 {
-	if (this->ExecuteATCommand(PLATFORMSTR("AT")))
+	if (mMaxLinkSpeed == 0)
 	{
-		while (true)
+		return;
+	}
+
+	mStore.erase("+IPR");
+
+	this->QueueCommandNext("AT+IPR=?", [](SIM800C& sim, bool ok, const Utf8String&)
 		{
-			if (mNeedCheckSms)
+			auto speed = sim.mLinkSpeed;
+			auto flow = sim.mLinkFlowControl;
+			auto wanted = sim.mWantFlowControl;
+
+			// the rates are unknown, switching blindly could lose the modem
+			if (!ok)
+			{
+				sim.OutputConsole(PLATFORMSTR("Link rate query failed, staying at "), speed, PLATFORMSTR(" baud"));
+				return true;
+			}
+
+			// highest rate of "(0,1200,...,115200),(...)" both sides support, 0 is autobaud
+			std::uint32_t target = 0;
+			std::uint32_t rate = 0;
+
+			for (auto c : sim.mStore["+IPR"] + ",")
 			{
-				mNeedCheckSms = false;
+				if (c >= '0' && c <= '9')
+				{
+					rate = rate * 10 + (c - '0');
+					continue;
+				}
 
-				if (!this->ExecuteATCommand(PLATFORMSTR("AT+CMGL=4")))
+				if (rate > target && rate <= sim.mMaxLinkSpeed && sim.mSerial->SupportsLinkSpeed(rate))
 				{
-					this->OutputConsole(PLATFORMSTR("CMGL (List SMS) command failed!"));
-					return false;
+					target = rate;
 				}
+
+				rate = 0;
+			}
+
+			if (target == 0)
+			{
+				target = speed;
+			}
+
+			if (target == speed && wanted == flow)
+			{
+				sim.OutputConsole(PLATFORMSTR("Link running at "), speed, PLATFORMSTR(" baud"));
+				return true;
+			}
+
+			std::vector<Utf8String> change;
+
+			if (wanted != flow)
+			{
+				change.push_back(wanted ? "+IFC=2,2" : "+IFC=0,0");
 			}
 
-			if (!ProcessCache())
+			if (target != speed)
 			{
+				change.push_back("+IPR=" + std::to_string(target));
+			}
+
+			// the modem answers at the old rate and switches afterwards
+			sim.QueueCommandNext(ConcatCommands(change), [speed, flow, target, wanted](SIM800C& sim, bool ok, const Utf8String&)
+				{
+					if (!ok)
+					{
+						sim.OutputConsole(PLATFORMSTR("Modem rejected the link change, staying at "), speed, PLATFORMSTR(" baud"));
+						return true;
+					}
+
+					if (!sim.SwitchLinkSpeed(target, wanted))
+					{
+						sim.OutputConsole(PLATFORMSTR("Unable to set the link speed!"));
+						return false;
+					}
+
+					sim.QueueCommandNext("AT", [speed, flow](SIM800C& sim, bool ok, const Utf8String&)
+						{
+							if (ok)
+							{
+								sim.SaveLinkSpeed();
+
+								sim.OutputConsole(PLATFORMSTR("Link running at "), sim.mLinkSpeed, sim.mLinkFlowControl ? PLATFORMSTR(" baud with RTS/CTS") : PLATFORMSTR(" baud"));
+								return true;
+							}
+
+							sim.OutputConsole(PLATFORMSTR("No answer at "), sim.mLinkSpeed, PLATFORMSTR(" baud, going back to "), speed, PLATFORMSTR(" baud..."));
+
+							// not again on this start
+							sim.mMaxLinkSpeed = speed;
+							sim.mWantFlowControl = flow;
+
+							if (!sim.SwitchLinkSpeed(speed, flow))
+							{
+								sim.OutputConsole(PLATFORMSTR("Unable to set the link speed!"));
+								return false;
+							}
+
+							sim.ProbeLink();
+
+							return true;
+						});
+
+					return true;
+				});
+
+			return true;
+		});
+}
+
+void SIM800C::BeginInit()
+{
+	mState = DeviceState::Initializing;
+	mInitStarted = std::chrono::steady_clock::now();
+
+	// starts at the rate that worked last time, raised once the modem answers
+	mLinkTried.clear();
+
+	this->LoadLinkSpeed();
+	this->ProbeLink();
+
+	// echo off, PIN state, own number and the current settings in one line
+	std::vector<Utf8String> query = { "E0", "+CPIN?", "+CNUM" };
+
+	mStore.erase("+CPIN");
+
+	for (auto& setting : SIM800CProfile)
+	{
+		query.push_back(Utf8String(setting.Code) + "?");
+
+		mStore.erase(Utf8String(setting.Code));
+	}
+
+	this->QueueCommand(ConcatCommands(query), [](SIM800C& sim, bool ok, const Utf8String&)
+		{
+			// a locked card fails the rest of the line as well, the PIN state tells why
+			auto pin = sim.mStore.find("+CPIN");
+
+			if (pin == sim.mStore.end())
+			{
+				sim.OutputConsole(PLATFORMSTR("PIN command failed!"));
 				return false;
 			}
 
-			PlatformString line;
-			if (!this->ReadLine(&line))
+			if (pin->second != "READY")
 			{
-				return !WaitExitOrTimeout(0ms);
+				sim.OutputConsole(PLATFORMSTR("SIM card requires a PIN. Remove the PIN and try again!"));
+				return false;
 			}
 
-			if (line == PLATFORMSTR(""))
+			if (!ok)
 			{
-				continue;
+				sim.OutputConsole(PLATFORMSTR("Query of own number and settings failed!"));
+				return false;
 			}
 
-			std::wsmatch match;
-			if (std::regex_search(line, match, mRegMatchATResult))
+			sim.OnSubscriberNumber(sim.GetSubscriberNumber());
+
+			if (!sim.HasProfile())
+			{
+				std::vector<Utf8String> apply;
+
+				for (auto& setting : SIM800CProfile)
+				{
+					apply.push_back(Utf8String(setting.Code) + "=" + Utf8String(setting.Value));
+				}
+
+				// the next start only has to verify it
+				apply.push_back("&W");
+
+				sim.OutputConsole(PLATFORMSTR("Writing modem profile..."));
+
+				sim.QueueCommandNext(ConcatCommands(apply), [](SIM800C& sim, bool ok, const Utf8String&)
+					{
+						if (!ok)
+						{
+							sim.OutputConsole(PLATFORMSTR("Writing modem profile failed!"));
+						}
+
+						return ok;
+					});
+			}
+
+			return true;
+		});
+
+	this->QueueCommand("AT+CMGL=4", [](SIM800C& sim, bool ok, const Utf8String&)
+		{
+			if (!ok)
 			{
-				this->OnCommand(match.str(1), match.suffix());
+				sim.OutputConsole(PLATFORMSTR("CMGL (List SMS) command failed!"));
+				return false;
 			}
-			else
+
+			sim.mState = DeviceState::Ready;
+			sim.mTimeToReady = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - sim.mInitStarted);
+
+			sim.OutputConsole(PLATFORMSTR("Ready after "), sim.mTimeToReady.count(), PLATFORMSTR("ms. Waiting for event..."));
+
+			sim.ProcessCache();
+
+			return true;
+		});
+}
+
+bool SIM800C::HasProfile()
+{
+	for (auto& setting : SIM800CProfile)
+	{
+		auto it = mStore.find(Utf8String(setting.Code));
+
+		// the first parameter is the one we set
+		if (it == mStore.end() || std::string_view(it->second).substr(0, it->second.find(',')) != setting.Value)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void SIM800C::OnSetting(std::string_view code, std::string_view value)
+{
+	mStore[Utf8String(code)] = value;
+}
+
+void SIM800C::OnMessageFormat(std::string_view value)
+{
+	this->OnSetting("+CMGF", value);
+}
+
+void SIM800C::OnRingFormat(std::string_view value)
+{
+	this->OnSetting("+CRC", value);
+}
+
+void SIM800C::OnSmsNotification(std::string_view value)
+{
+	this->OnSetting("+CNMI", value);
+}
+
+void SIM800C::OnLinkSpeeds(std::string_view value)
+{
+	this->OnSetting("+IPR", value);
+}
+
+void SIM800C::ProcessLine(std::string_view line)
+{
+	mLastActivity = std::chrono::steady_clock::now();
+
+	if (line != "")
+	{
+		this->OutputDebug(PLATFORMSTR("< "), line);
+	}
+
+	// the PDU is never empty, a stray line break must not take its place
+	if (mNeedSmsPdu && line != "")
+	{
+		mNeedSmsPdu = false;
+		mSmsCache.push_back({ mPendingSms, Utf8String(line) });
+		return;
+	}
+
+	if (line == "" || (mCommandSent && line == mCommands.front().Command))
+	{
+		return;
+	}
+
+	std::string_view code;
+	std::string_view value;
+	if (this->ParseResult(line, &code, &value))
+	{
+		this->OnCommand(code, value);
+	}
+	else if (!mCommandSent)
+	{
+		this->OutputConsole(PLATFORMSTR("Unhandled unsolicited event: "), line);
+	}
+	else if (this->IsOKCommand(line))
+	{
+		this->CompleteCommand(true);
+	}
+	else if (this->IsErrorCommand(line))
+	{
+		this->CompleteCommand(false);
+	}
+	else if (mCommands.front().CaptureReturn)
+	{
+		if (mCommandReturn != "")
+		{
+			this->OutputConsole(PLATFORMSTR("Unhandled return: "), mCommandReturn);
+		}
+
+		mCommandReturn = line;
+	}
+	else
+	{
+		this->OutputConsole(PLATFORMSTR("Unhandled return: "), line);
+	}
+
+	this->Poll();
+}
+
+void SIM800C::ProcessAvailable()
+{
+	std::string_view line;
+	while (mState != DeviceState::Failed && mSerial->TryReadLine(&line))
+	{
+		this->ProcessLine(line);
+	}
+}
+
+void SIM800C::OnIdle()
+{
+	mLastActivity = std::chrono::steady_clock::now();
+
+	if (mCommandSent)
+	{
+		// no answer in time
+		this->CompleteCommand(false);
+		return;
+	}
+
+	// keep alive, drops the device if it does not respond anymore
+	this->QueueCommand("AT", [](SIM800C&, bool ok, const Utf8String&) { return ok; });
+}
+
+void SIM800C::CheckTimeout(std::chrono::steady_clock::time_point now)
+{
+	if (mState != DeviceState::Failed && now >= this->GetNextTimeout())
+	{
+		this->OnIdle();
+	}
+}
+
+std::chrono::steady_clock::time_point SIM800C::GetNextTimeout() const
+{
+	return mLastActivity + 15s;
+}
+
+bool SIM800C::IsReady() const
+{
+	return mState == DeviceState::Ready;
+}
+
+bool SIM800C::IsFailed() const
+{
+	return mState == DeviceState::Failed;
+}
+
+bool SIM800C::Init()
+{
+	this->BeginInit();
+
+	while (mState == DeviceState::Initializing)
+	{
+		std::string_view line;
+		if (this->ReadLine(&line))
+		{
+			this->ProcessLine(line);
+		}
+		else if (WaitExitOrTimeout(0ms))
+		{
+			return false;
+		}
+		else
+		{
+			this->OnIdle();
+		}
+	}
+
+	return mState == DeviceState::Ready;
+}
+
+bool SIM800C::PerformLoop()
+{
+	while (mState == DeviceState::Ready)
+	{
+		std::string_view line;
+		if (!this->ReadLine(&line))
+		{
+			if (WaitExitOrTimeout(0ms))
 			{
-				this->OutputConsole(PLATFORMSTR("Unhandled unsolicited event: "), line);
+				return false;
 			}
+
+			this->OnIdle();
+
+			break;
 		}
+
+		this->ProcessLine(line);
 	}
 
-	return false;
+	return mState == DeviceState::Ready;
+}
+
+const PlatformString& SIM800C::GetPort() const
+{
+	return mPort;
+}
+
+const SmsTrace& SIM800C::GetSmsTrace() const
+{
+	return mSmsTrace;
+}
+
+Utf8String SIM800C::GetSubscriberNumber()
+{
+	return mStore["+CNUM"];
 }
 
-PlatformString SIM800C::GetSubscriberNumber()
+std::chrono::milliseconds SIM800C::GetTimeToReady() const
 {
-	return mStore[PLATFORMSTR("+CNUM")];
+	return mTimeToReady;
 }
\ No newline at end of file
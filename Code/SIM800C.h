@@ -10,69 +10,190 @@
 #pragma once
 
 #include "Shared.h"
+#include "Logger.h"
+#include "SmsReassembler.h"
+
+class MetricCounter;
+class MetricGauge;
+
+// monotonic stamps of a message on its way from the modem, unset ones are zero
+struct SmsTrace
+{
+	std::chrono::steady_clock::time_point Indicated;
+	std::chrono::steady_clock::time_point Listed;
+	std::chrono::steady_clock::time_point Parsed;
+};
 
 class SIM800C
 {
+	friend struct SIM800CResultHandlers;
+public:
+	// the modem autobauds from here after a reset
+	static constexpr std::uint32_t DefaultLinkSpeed = 9600;
+
+	// tried in this order when the modem does not answer, a rate written to its profile survives a reset
+	static constexpr std::uint32_t ScanLinkSpeeds[] = { 9600, 115200, 57600, 38400, 19200, 230400, 460800, 921600 };
 private:
 	struct SmsCacheItem
 	{
-		PlatformString Command;
-		PlatformString PDU;
+		Utf8String Command;
+		Utf8String PDU;
 	};
 	struct CallerCacheItem
 	{
-		PlatformString Caller;
-		PlatformString Date;
+		Utf8String Caller;
+		Utf8String Date;
+	};
+
+	// returns false if the device can not be used anymore
+	using CommandHandler = std::function<bool(SIM800C&, bool, const Utf8String&)>;
+
+	struct CommandItem
+	{
+		Utf8String Command;
+		CommandHandler OnDone;
+		bool CaptureReturn;
+	};
+
+	enum class DeviceState
+	{
+		Idle,
+		Initializing,
+		Ready,
+		Failed
 	};
 
 	std::filesystem::path mRoot;
 	PlatformString mPort;
 	std::shared_ptr<PlatformSerial> mSerial;
-	std::wregex mRegMatchATResult = std::wregex(PLATFORMSTR("^(\\+[0-9a-z]+):[\t ]+"), std::wregex::icase);
-	std::wregex mRegMatchSmsIndex = std::wregex(PLATFORMSTR("^([0-9]+),"), std::wregex::icase);
-	std::wregex mRegMatchCallerId = std::wregex(PLATFORMSTR("^['\"]?([^,'\"]+)['\"]?,"), std::wregex::icase);
-	std::wregex mRegMatchSubscriberNumber = std::wregex(PLATFORMSTR("^(?:(['\"]).*?\\1)?,(['\"])(.*?)\\2,"), std::wregex::icase);
-	std::map<PlatformString, PlatformString> mStore;
+	std::regex mRegMatchSmsIndex = std::regex("^([0-9]+),", std::regex::icase);
+	std::regex mRegMatchCallerId = std::regex("^['\"]?([^,'\"]+)['\"]?,", std::regex::icase);
+	std::regex mRegMatchSubscriberNumber = std::regex("^(?:(['\"]).*?\\1)?,(['\"])(.*?)\\2,", std::regex::icase);
+	std::map<Utf8String, Utf8String> mStore;
 	std::vector<SmsCacheItem> mSmsCache;
+	SmsReassembler mReassembler{ 64, std::chrono::minutes(5) };
 	bool mNeedCheckSms = false;
+	std::chrono::steady_clock::time_point mSmsIndicated;
+	SmsTrace mSmsTrace;
+	bool mBulkDelete = true;
 	std::vector<CallerCacheItem> mCallerCache;
-	PlatformString mRecentCaller;
+	Utf8String mRecentCaller;
 	std::chrono::steady_clock::time_point mRecentCallerTime;
+	std::deque<CommandItem> mCommands;
+	bool mCommandSent = false;
+	Utf8String mCommandReturn;
+	bool mNeedSmsPdu = false;
+	Utf8String mPendingSms;
+	DeviceState mState = DeviceState::Idle;
+	std::chrono::steady_clock::time_point mLastActivity;
+	std::chrono::steady_clock::time_point mInitStarted;
+	std::chrono::milliseconds mTimeToReady{ 0 };
+
+	// serial line, raised after the first answer and remembered per port
+	std::uint32_t mLinkSpeed = DefaultLinkSpeed;
+	bool mLinkFlowControl = false;
+	std::vector<std::uint32_t> mLinkTried;
+	std::uint32_t mMaxLinkSpeed = 115200;
+	bool mWantFlowControl = false;
+
+	// owned by the registry and shared by every device on the same port
+	MetricCounter* mSmsReceived = nullptr;
+	MetricCounter* mSmsParseFailures = nullptr;
+	MetricCounter* mCalls = nullptr;
+	MetricCounter* mCallsDeduplicated = nullptr;
+	MetricGauge* mNetworkState = nullptr;
 
-	bool WriteLine(const PlatformString&);
-	bool ReadLine(PlatformString*);
-	bool ProcessCache();
-	bool IsOKCommand(const PlatformString&);
-	bool IsErrorCommand(const PlatformString&);
-	bool IsOKOrErrorCommand(const PlatformString&);
-	bool ExecuteATCommand(const PlatformString&);
-	bool ExecuteATCommand(const PlatformString&, PlatformString*);
-	void PrintNetworkState(const PlatformString&);
-	void OnCommand(const PlatformString&, const PlatformString&);
-	bool ProcessSms(const PlatformString&, const PlatformString&);
+	bool WriteLine(const Utf8String&);
+	bool ReadLine(std::string_view*);
+	void ProcessCache();
+	void ProcessCallerCache();
+	bool IsOKCommand(std::string_view);
+	bool IsErrorCommand(std::string_view);
+	bool IsOKOrErrorCommand(std::string_view);
+	void QueueCommand(const Utf8String&, const PlatformString&);
+	void QueueCommand(const Utf8String&, const CommandHandler&, bool = false);
+	void QueueCommandNext(const Utf8String&, const CommandHandler&, bool = false);
+	void SendNextCommand();
+	void CompleteCommand(bool);
+	void Fail();
+	void Poll();
+	void PrintNetworkState(std::string_view);
+	bool ParseResult(std::string_view, std::string_view*, std::string_view*);
+	void OnCommand(std::string_view, std::string_view);
+	void OnPinState(std::string_view);
+	void OnSubscriberNumberResult(std::string_view);
+	void OnSmsListEntry(std::string_view);
+	void OnSmsIndication(std::string_view);
+	void OnRing(std::string_view);
+	void OnCallerId(std::string_view);
+	void OnSetting(std::string_view, std::string_view);
+	void OnMessageFormat(std::string_view);
+	void OnRingFormat(std::string_view);
+	void OnSmsNotification(std::string_view);
+	bool HasProfile();
+	void OnSubscriberNumber(Utf8String);
+	bool ProcessSms(const Utf8String&, const Utf8String&, std::vector<int>*);
+	void CommitSms(const std::vector<int>&, bool);
+	void DeleteSms(const std::vector<int>&, bool);
+	bool DeliverSms(const std::vector<SmsReassembler::Message>&, std::vector<int>*);
+	std::filesystem::path GetLinkFile() const;
+	void LoadLinkSpeed();
+	void SaveLinkSpeed();
+	bool SwitchLinkSpeed(std::uint32_t, bool);
+	void ProbeLink();
+	bool ScanLink();
+	void TuneLink();
+	void OnLinkSpeeds(std::string_view);
 
 public:
 
-	void (*OnNewSms)(SIM800C&, const PlatformString&, const PlatformString&, const PlatformString&) = 0;
-	void (*OnNewCaller)(SIM800C&, const PlatformString&, const PlatformString&) = 0;
+	// the flag marks a concatenated message that timed out with parts missing
+	// returns false if the message could not be stored, it stays on the SIM card then
+	bool (*OnNewSms)(SIM800C&, const Utf8String&, const Utf8String&, const Utf8String&, bool) = 0;
+
+	// called once per listing before the stored messages are deleted from the SIM card
+	bool (*OnCommitSms)(SIM800C&) = 0;
+	void (*OnNewCaller)(SIM800C&, const Utf8String&, const Utf8String&) = 0;
 
 	SIM800C();
 	SIM800C(const std::filesystem::path&, const PlatformString&, const std::shared_ptr<PlatformSerial>&);
 
+	// highest rate negotiated with AT+IPR, 0 stays at the default rate, flow control needs RTS/CTS wired
+	void SetLinkOptions(std::uint32_t, bool);
+
+	// blocking, used when every device runs on its own thread
 	bool Init();
 	bool PerformLoop();
 
+	// non-blocking, used when devices are multiplexed on a reactor
+	void BeginInit();
+	void ProcessLine(std::string_view);
+	void ProcessAvailable();
+	void OnIdle();
+	void CheckTimeout(std::chrono::steady_clock::time_point);
+	std::chrono::steady_clock::time_point GetNextTimeout() const;
+	bool IsReady() const;
+	bool IsFailed() const;
+
 	template<typename... Args>
 	void OutputConsole(Args&&... args)
 	{
-		const std::lock_guard<std::mutex> lock(ConsoleLock);
+		ConsoleOut(PLATFORMSTR("Device at "), mPort, PLATFORMSTR(": "), std::forward<Args>(args)...);
+	}
 
-		PLATFORMCOUT << PLATFORMSTR("Device at ") << mPort << PLATFORMSTR(": ");
+	// traffic on the serial line, only formatted with debug logging enabled
+	template<typename... Args>
+	void OutputDebug(Args&&... args)
+	{
+		ConsoleDebug(PLATFORMSTR("Device at "), mPort, PLATFORMSTR(": "), std::forward<Args>(args)...);
+	}
 
-		(PLATFORMCOUT << ... << args);
+	const PlatformString& GetPort() const;
 
-		PLATFORMCOUT << std::endl;
-	}
+	// stamps of the message handed to OnNewSms right now
+	const SmsTrace& GetSmsTrace() const;
+	Utf8String GetSubscriberNumber();
 
-	PlatformString GetSubscriberNumber();
+	// from the first command to the end of the initial SMS listing
+	std::chrono::milliseconds GetTimeToReady() const;
 };
\ No newline at end of file
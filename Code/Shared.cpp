@@ -8,8 +8,7 @@
 // SOFTWARE.
 
 #include "Shared.h"
-
-std::mutex ConsoleLock;
+#include "Logger.h"
 
 Utf8String PlatformStringToUtf8(const PlatformString& str)
 {
@@ -29,7 +28,12 @@ void ParseArguments(const std::vector<PlatformString>& args, std::map<PlatformSt
 	{
 		if (item.size() > 0)
 		{
+#if defined(WINDOWS) || defined(WIN32) || defined(_WIN32)
 			if (item[0] == PLATFORMSTR('-') || item[0] == PLATFORMSTR('/'))
+#else
+			// an absolute path is a value, not a switch
+			if (item[0] == PLATFORMSTR('-'))
+#endif
 			{
 				it = parsed.insert_or_assign(item.substr(1), PlatformString()).first;
 			}
@@ -61,70 +65,104 @@ bool ValidateArguments(const std::map<PlatformString, PlatformString, PlatformCI
 	return true;
 }
 
-struct upload_status {
-	Utf8String* data;
-	size_t bytes_read;
-};
-
 #define CANCELEMAILIFNECESSARY if (res != CURLE_OK) goto CLEANUP
 
-bool SendEmail(const PlatformString& subject, const PlatformString& message, const PlatformString& smtpusername, const PlatformString& smtppassword, const PlatformString& smtpserver, const PlatformString& smtpfromto)
+SmtpTransport::SmtpTransport(const PlatformString& smtpusername, const PlatformString& smtppassword, const PlatformString& smtpserver, const PlatformString& smtpfromto, size_t concurrency)
 {
-	CURL* curl;
-	CURLcode res = CURLE_FAILED_INIT;
-	curl_slist* recipients = NULL;
-	upload_status upload_ctx = { 0 };
-	PlatformStream strm;
-	std::time_t t = std::time(nullptr);
-	std::tm* tx = localtime(&t);
+	mUsername = PlatformStringToUtf8(smtpusername);
+	mPassword = PlatformStringToUtf8(smtppassword);
+	// "host" uses the submission port, "host:port" any other
+	auto port = smtpserver.find(PLATFORMSTR(':')) == PlatformString::npos ? PLATFORMSTR(":587") : PLATFORMSTR("");
 
-	strm << PLATFORMSTR("Date: ") << std::put_time(tx, L"%a, %d %b %Y %T %z") << PLATFORMSTR("\r\n")
-		<< PLATFORMSTR("To: ") << smtpfromto << PLATFORMSTR("\r\n")
-		<< PLATFORMSTR("From: ") << smtpfromto << PLATFORMSTR("\r\n")
-		<< PLATFORMSTR("Subject: ") << subject << PLATFORMSTR("\r\n")
-		<< PLATFORMSTR("Content-Type: text/plain; charset=utf-8\r\n")
-		<< PLATFORMSTR("\r\n") << message << PLATFORMSTR("\r\n");
+	mUrl = PlatformStringToUtf8(PlatformString(PLATFORMSTR("smtp://")).append(smtpserver).append(port).append(PLATFORMSTR("/SmsRouterPi")));
+	mFromTo = PlatformStringToUtf8(smtpfromto);
 
-	Utf8String msg(PlatformStringToUtf8(strm.str()));
+	mMulti = curl_multi_init();
+
+	for (size_t i = 0; i < std::max<size_t>(concurrency, 1); i++)
+	{
+		mTransfers.push_back(std::make_unique<Transfer>());
+	}
+
+	if (mMulti)
+	{
+		// one session per transfer, kept open between mails
+		curl_multi_setopt(mMulti, CURLMOPT_MAX_HOST_CONNECTIONS, (long)mTransfers.size());
+		curl_multi_setopt(mMulti, CURLMOPT_MAXCONNECTS, (long)mTransfers.size());
+	}
+}
 
-	upload_ctx.data = &msg;
+SmtpTransport::~SmtpTransport()
+{
+	for (auto& transfer : mTransfers)
+	{
+		this->Disconnect(*transfer);
+	}
 
-	curl = curl_easy_init();
+	if (mMulti)
+	{
+		curl_multi_cleanup(mMulti);
+	}
+}
 
-	if (!curl)
+bool SmtpTransport::Connect(Transfer& transfer)
+{
+	if (transfer.Curl)
+	{
+		return true;
+	}
+
+	CURLcode res = CURLE_FAILED_INIT;
+
+	transfer.Curl = curl_easy_init();
+
+	if (!transfer.Curl)
 	{
 		return false;
 	}
 
-	res = curl_easy_setopt(curl, CURLOPT_USERNAME, PlatformStringToUtf8(smtpusername).c_str());
+	res = curl_easy_setopt(transfer.Curl, CURLOPT_PRIVATE, &transfer);
 
 	CANCELEMAILIFNECESSARY;
 
-	res = curl_easy_setopt(curl, CURLOPT_PASSWORD, PlatformStringToUtf8(smtppassword).c_str());
+	res = curl_easy_setopt(transfer.Curl, CURLOPT_USERNAME, mUsername.c_str());
 
 	CANCELEMAILIFNECESSARY;
 
-	res = curl_easy_setopt(curl, CURLOPT_URL, PlatformStringToUtf8(PlatformString(PLATFORMSTR("smtp://")).append(smtpserver).append(PLATFORMSTR(":587/SmsRouterPi"))).c_str());
+	res = curl_easy_setopt(transfer.Curl, CURLOPT_PASSWORD, mPassword.c_str());
 
 	CANCELEMAILIFNECESSARY;
 
-	res = curl_easy_setopt(curl, CURLOPT_USE_SSL, (long)CURLUSESSL_ALL);
+	res = curl_easy_setopt(transfer.Curl, CURLOPT_URL, mUrl.c_str());
 
 	CANCELEMAILIFNECESSARY;
 
-	res = curl_easy_setopt(curl, CURLOPT_MAIL_FROM, PlatformStringToUtf8(smtpfromto).c_str());
+	res = curl_easy_setopt(transfer.Curl, CURLOPT_USE_SSL, (long)CURLUSESSL_ALL);
 
 	CANCELEMAILIFNECESSARY;
 
-	recipients = curl_slist_append(recipients, PlatformStringToUtf8(smtpfromto).c_str());
+	if (mCertificate.size() > 0)
+	{
+		curl_blob blob = { (void*)mCertificate.data(), mCertificate.size(), CURL_BLOB_COPY };
+
+		res = curl_easy_setopt(transfer.Curl, CURLOPT_CAINFO_BLOB, &blob);
 
-	res = curl_easy_setopt(curl, CURLOPT_MAIL_RCPT, recipients);
+		CANCELEMAILIFNECESSARY;
+	}
+
+	res = curl_easy_setopt(transfer.Curl, CURLOPT_MAIL_FROM, mFromTo.c_str());
 
 	CANCELEMAILIFNECESSARY;
 
-	res = curl_easy_setopt(curl, CURLOPT_READFUNCTION, +[](char* ptr, size_t size, size_t nmemb, void* userp)->size_t
+	transfer.Recipients = curl_slist_append(transfer.Recipients, mFromTo.c_str());
+
+	res = curl_easy_setopt(transfer.Curl, CURLOPT_MAIL_RCPT, transfer.Recipients);
+
+	CANCELEMAILIFNECESSARY;
+
+	res = curl_easy_setopt(transfer.Curl, CURLOPT_READFUNCTION, +[](char* ptr, size_t size, size_t nmemb, void* userp)->size_t
 		{ {
-				struct upload_status* upload_ctx = (struct upload_status*)userp;
+				UploadStatus* upload_ctx = (UploadStatus*)userp;
 
 				size_t room = size * nmemb;
 
@@ -133,11 +171,11 @@ bool SendEmail(const PlatformString& subject, const PlatformString& message, con
 					return 0;
 				}
 
-				auto data = upload_ctx->data->c_str() + upload_ctx->bytes_read;
+				auto data = upload_ctx->Data->c_str() + upload_ctx->BytesRead;
 
 				if (data)
 				{
-					size_t len = upload_ctx->data->size() - upload_ctx->bytes_read;
+					size_t len = upload_ctx->Data->size() - upload_ctx->BytesRead;
 
 					if (len > 0)
 					{
@@ -148,7 +186,7 @@ bool SendEmail(const PlatformString& subject, const PlatformString& message, con
 
 						std::memcpy(ptr, data, len);
 
-						upload_ctx->bytes_read += len;
+						upload_ctx->BytesRead += len;
 
 						return len;
 					}
@@ -159,29 +197,236 @@ bool SendEmail(const PlatformString& subject, const PlatformString& message, con
 
 	CANCELEMAILIFNECESSARY;
 
-	res = curl_easy_setopt(curl, CURLOPT_READDATA, &upload_ctx);
+	res = curl_easy_setopt(transfer.Curl, CURLOPT_READDATA, &transfer.Upload);
 
 	CANCELEMAILIFNECESSARY;
 
-	res = curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+	res = curl_easy_setopt(transfer.Curl, CURLOPT_UPLOAD, 1L);
 
 	CANCELEMAILIFNECESSARY;
 
-	res = curl_easy_perform(curl);
+	res = curl_easy_setopt(transfer.Curl, CURLOPT_XFERINFOFUNCTION, +[](void* clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t)->int
+		{
+			return std::chrono::steady_clock::now() >= ((SmtpTransport*)clientp)->mDeadline.load() ? 1 : 0;
+		});
+
+	CANCELEMAILIFNECESSARY;
+
+	res = curl_easy_setopt(transfer.Curl, CURLOPT_XFERINFODATA, this);
+
+	CANCELEMAILIFNECESSARY;
+
+	res = curl_easy_setopt(transfer.Curl, CURLOPT_NOPROGRESS, 0L);
 
 CLEANUP:;
 
-	if (recipients)
+	if (res != CURLE_OK)
 	{
-		curl_slist_free_all(recipients);
+		ConsoleErr(PLATFORMSTR("Mail session setup failed: "), curl_easy_strerror(res));
+
+		this->Disconnect(transfer);
+
+		return false;
 	}
 
-	curl_easy_cleanup(curl);
+	return true;
+}
 
-	if (res != CURLE_OK)
+void SmtpTransport::Disconnect(Transfer& transfer)
+{
+	if (transfer.Curl)
+	{
+		if (transfer.Active && mMulti)
+		{
+			curl_multi_remove_handle(mMulti, transfer.Curl);
+		}
+
+		curl_easy_cleanup(transfer.Curl);
+		transfer.Curl = nullptr;
+	}
+
+	if (transfer.Recipients)
+	{
+		curl_slist_free_all(transfer.Recipients);
+		transfer.Recipients = nullptr;
+	}
+
+	if (transfer.Active)
+	{
+		transfer.Active = false;
+		mActive--;
+	}
+}
+
+bool SmtpTransport::Start(const Utf8String& subject, const Utf8String& message, std::uint64_t tag, const Utf8String& headers)
+{
+	auto free = std::find_if(mTransfers.begin(), mTransfers.end(), [](const std::unique_ptr<Transfer>& transfer) { return !transfer->Active; });
+
+	if (!mMulti || free == mTransfers.end())
+	{
+		return false;
+	}
+
+	Transfer& transfer = **free;
+
+	std::stringstream strm;
+	std::time_t t = std::time(nullptr);
+	std::tm* tx = localtime(&t);
+
+	strm << "Date: " << std::put_time(tx, "%a, %d %b %Y %T %z") << "\r\n"
+		<< "To: " << mFromTo << "\r\n"
+		<< "From: " << mFromTo << "\r\n"
+		<< "Subject: " << subject << "\r\n"
+		<< "Content-Type: text/plain; charset=utf-8\r\n"
+		<< headers
+		<< "\r\n" << message << "\r\n";
+
+	if (!this->Connect(transfer))
+	{
+		return false;
+	}
+
+	transfer.Data = strm.str();
+	transfer.Upload = { &transfer.Data, 0 };
+	transfer.Tag = tag;
+
+	// reuses an open session, the next mail starts with MAIL FROM right away
+	if (curl_multi_add_handle(mMulti, transfer.Curl) != CURLM_OK)
 	{
-		std::cout << curl_easy_strerror(res) << std::endl;
+		this->Disconnect(transfer);
+		return false;
 	}
 
-	return res == CURLE_OK;
-}
\ No newline at end of file
+	transfer.Active = true;
+	mActive++;
+
+	return true;
+}
+
+void SmtpTransport::CollectDone(std::vector<std::pair<std::uint64_t, bool>>* done)
+{
+	int queued = 0;
+
+	while (CURLMsg* msg = curl_multi_info_read(mMulti, &queued))
+	{
+		if (msg->msg != CURLMSG_DONE)
+		{
+			continue;
+		}
+
+		Transfer* transfer = nullptr;
+		curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&transfer);
+
+		CURLcode res = msg->data.result;
+
+		curl_multi_remove_handle(mMulti, msg->easy_handle);
+
+		transfer->Active = false;
+		transfer->Upload = { nullptr, 0 };
+		transfer->Data.clear();
+		mActive--;
+
+		if (res != CURLE_OK)
+		{
+			ConsoleErr(PLATFORMSTR("Mail transfer failed: "), curl_easy_strerror(res));
+
+			// start over with a fresh session on the next mail
+			this->Disconnect(*transfer);
+		}
+
+		done->push_back({ transfer->Tag, res == CURLE_OK });
+	}
+}
+
+void SmtpTransport::Perform(std::chrono::milliseconds timeout, std::vector<std::pair<std::uint64_t, bool>>* done)
+{
+	if (!mMulti)
+	{
+		return;
+	}
+
+	size_t before = done->size();
+
+	int running = 0;
+
+	curl_multi_perform(mMulti, &running);
+
+	this->CollectDone(done);
+
+	if (done->size() == before)
+	{
+		curl_multi_poll(mMulti, nullptr, 0, (int)timeout.count(), nullptr);
+
+		curl_multi_perform(mMulti, &running);
+
+		this->CollectDone(done);
+	}
+}
+
+void SmtpTransport::Wakeup()
+{
+	if (mMulti)
+	{
+		curl_multi_wakeup(mMulti);
+	}
+}
+
+void SmtpTransport::Cancel()
+{
+	for (auto& transfer : mTransfers)
+	{
+		if (transfer->Active)
+		{
+			this->Disconnect(*transfer);
+		}
+	}
+}
+
+void SmtpTransport::SetDeadline(std::chrono::steady_clock::time_point deadline)
+{
+	mDeadline = deadline;
+}
+
+std::chrono::steady_clock::time_point SmtpTransport::GetDeadline() const
+{
+	return mDeadline;
+}
+
+void SmtpTransport::SetCertificate(const Utf8String& certificate)
+{
+	mCertificate = certificate;
+}
+
+bool SmtpTransport::Send(const Utf8String& subject, const Utf8String& message)
+{
+	// any tag works, nothing else is in flight when this is used
+	if (!this->Start(subject, message, 0))
+	{
+		return false;
+	}
+
+	std::vector<std::pair<std::uint64_t, bool>> done;
+
+	while (done.empty())
+	{
+		if (WaitExitOrTimeout(0ms))
+		{
+			this->Cancel();
+			return false;
+		}
+
+		this->Perform(1s, &done);
+	}
+
+	return done.front().second;
+}
+
+size_t SmtpTransport::GetActive() const
+{
+	return mActive;
+}
+
+size_t SmtpTransport::GetCapacity() const
+{
+	return mTransfers.size();
+}
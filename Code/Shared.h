@@ -19,11 +19,21 @@
 #include <map>
 #include <string>
 #include <algorithm>
+#include <array>
 #include <regex>
 #include <iomanip>
+#include <bit>
+#include <cstring>
+#include <string_view>
 #include <condition_variable>
+#include <deque>
+#include <atomic>
 #include <curl/curl.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+
 using namespace std::chrono_literals;
 
 template<typename ...Args>
@@ -64,10 +74,6 @@ To ConvertMultiByte(const From& str, auto cvt)
 	return To();
 }
 
-Utf8String PlatformStringToUtf8(const PlatformString&);
-PlatformString Utf8ToPlatformString(const Utf8String&);
-PlatformString UCS2ToPlatformString(const std::u16string&);
-
 struct PlatformCIComparer
 {
 	bool operator()(const PlatformString& a, const PlatformString& b) const
@@ -93,7 +99,74 @@ struct PlatformCIComparer
 
 void ParseArguments(const std::vector<PlatformString>& args, std::map<PlatformString, PlatformString, PlatformCIComparer>& parsed);
 bool ValidateArguments(const std::map<PlatformString, PlatformString, PlatformCIComparer>& parsed, const std::vector<PlatformString>& required);
-bool SendEmail(const PlatformString& subject, const PlatformString& message, const PlatformString& smtpusername, const PlatformString& smtppassword, const PlatformString& smtpserver, const PlatformString& smtpfromto);
+
+// keeps up to a fixed number of smtp sessions open and sends on all of them at once, only Wakeup is thread safe
+class SmtpTransport
+{
+private:
+	struct UploadStatus
+	{
+		const Utf8String* Data;
+		size_t BytesRead;
+	};
+
+	struct Transfer
+	{
+		CURL* Curl = nullptr;
+		curl_slist* Recipients = nullptr;
+		Utf8String Data;
+		UploadStatus Upload = { nullptr, 0 };
+		std::uint64_t Tag = 0;
+		bool Active = false;
+	};
+
+	Utf8String mUsername;
+	Utf8String mPassword;
+	Utf8String mUrl;
+	Utf8String mFromTo;
+	Utf8String mCertificate;
+	CURLM* mMulti = nullptr;
+	std::vector<std::unique_ptr<Transfer>> mTransfers;
+	size_t mActive = 0;
+
+	// checked by curl while a transfer runs, also inside its blocking wait for the end of data reply
+	std::atomic<std::chrono::steady_clock::time_point> mDeadline = std::chrono::steady_clock::time_point::max();
+
+	bool Connect(Transfer&);
+	void Disconnect(Transfer&);
+	void CollectDone(std::vector<std::pair<std::uint64_t, bool>>*);
+
+public:
+	SmtpTransport(const PlatformString& smtpusername, const PlatformString& smtppassword, const PlatformString& smtpserver, const PlatformString& smtpfromto, size_t concurrency = 1);
+	SmtpTransport(const SmtpTransport&) = delete;
+	SmtpTransport& operator=(const SmtpTransport&) = delete;
+	~SmtpTransport();
+
+	// trusts only this pem certificate instead of the system store, for the local mail sink
+	void SetCertificate(const Utf8String&);
+
+	// blocking, waits for this mail only and gives up on exit
+	bool Send(const Utf8String& subject, const Utf8String& message);
+
+	// returns false if all sessions are busy, extra header lines end with "\r\n"
+	bool Start(const Utf8String& subject, const Utf8String& message, std::uint64_t tag, const Utf8String& headers = Utf8String());
+
+	// drives all transfers, waits up to the timeout if none finished and reports every finished tag
+	void Perform(std::chrono::milliseconds timeout, std::vector<std::pair<std::uint64_t, bool>>* done);
+
+	// interrupts a waiting Perform
+	void Wakeup();
+
+	// aborts every transfer in flight, nothing is reported for them
+	void Cancel();
+
+	// transfers still running then fail, thread safe
+	void SetDeadline(std::chrono::steady_clock::time_point);
+	std::chrono::steady_clock::time_point GetDeadline() const;
+
+	size_t GetActive() const;
+	size_t GetCapacity() const;
+};
 
 template<typename T>
 bool Equal(const T& a, const T& b)
@@ -101,46 +174,181 @@ bool Equal(const T& a, const T& b)
 	return std::equal(a.begin(), a.end(), b.begin(), b.end());
 }
 
+inline const Utf8Char* FindLineBreak(const Utf8Char* it, const Utf8Char* end)
+{
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	const __m128i crs = _mm_set1_epi8('\r');
+	const __m128i lfs = _mm_set1_epi8('\n');
+
+	for (; end - it >= 16; it += 16)
+	{
+		__m128i chunk = _mm_loadu_si128((const __m128i*)it);
+
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, crs), _mm_cmpeq_epi8(chunk, lfs)));
+
+		if (mask != 0)
+		{
+			return it + std::countr_zero((unsigned int)mask);
+		}
+	}
+#endif
+
+	// memchr is vectorized by the C library on every other platform
+	auto lf = (const Utf8Char*)std::memchr(it, '\n', end - it);
+	auto cr = (const Utf8Char*)std::memchr(it, '\r', (lf ? lf : end) - it);
+
+	return cr ? cr : (lf ? lf : end);
+}
+
 class PlatformSerial
 {
 private:
-	std::regex mRegMatchNL = std::regex("^([^\r\n]*)[\r\n]+", std::regex::icase);
+	// unread data is [mReadLineStart, mReadLineEnd), lines are handed out as views into it
+	std::vector<Utf8Char> mReadLineBuffer;
+	size_t mReadLineStart;
+	size_t mReadLineEnd;
+	size_t mReadLineScan;
+	// the last line break ended with the data, its rest may come with the next read
+	bool mReadLineBreak;
 protected:
-	Utf8String mReadLineBuffer;
-	Utf8Char* mReadBuffer;
-	std::uint32_t mReadBufferNum;
+	static constexpr size_t ReadChunkSize = 256;
+	static constexpr size_t MaxReadLineBuffer = 64 * 1024;
 
 	PlatformSerial()
 	{
-		mReadBufferNum = 256;
-		mReadBuffer = new Utf8Char[mReadBufferNum];
+		mReadLineBuffer.resize(4 * ReadChunkSize);
+		mReadLineStart = 0;
+		mReadLineEnd = 0;
+		mReadLineScan = 0;
+		mReadLineBreak = false;
 	}
 
 	~PlatformSerial()
 	{
-		delete[] mReadBuffer;
+		// nothing
 	}
 
-	bool CanReadLine(Utf8String* line)
+	// space to read at least ReadChunkSize bytes into, invalidates handed out lines
+	Utf8Char* PrepareRead(std::uint32_t* num)
 	{
-		std::smatch match;
-		if (!std::regex_search(mReadLineBuffer, match, this->mRegMatchNL))
+		if (mReadLineStart == mReadLineEnd)
 		{
-			return false;
+			mReadLineStart = mReadLineEnd = mReadLineScan = 0;
 		}
+		else if (mReadLineBuffer.size() - mReadLineEnd < ReadChunkSize && mReadLineStart > 0)
+		{
+			std::memmove(mReadLineBuffer.data(), mReadLineBuffer.data() + mReadLineStart, mReadLineEnd - mReadLineStart);
 
-		line->assign(match.str(1));
+			mReadLineEnd -= mReadLineStart;
+			mReadLineScan -= mReadLineStart;
+			mReadLineStart = 0;
+		}
 
-		mReadLineBuffer = match.suffix();
+		if (mReadLineBuffer.size() - mReadLineEnd < ReadChunkSize)
+		{
+			mReadLineBuffer.resize(std::min(mReadLineBuffer.size() * 2, MaxReadLineBuffer + ReadChunkSize));
+		}
+
+		*num = (std::uint32_t)(mReadLineBuffer.size() - mReadLineEnd);
+
+		return mReadLineBuffer.data() + mReadLineEnd;
+	}
+
+	void CommitRead(std::uint32_t num)
+	{
+		mReadLineEnd += num;
+	}
+
+	bool CanReadLine(std::string_view* line)
+	{
+		auto data = mReadLineBuffer.data();
+		auto end = data + mReadLineEnd;
+
+		// "\r" and "\n" of one break split across two reads must not make an empty line
+		if (mReadLineBreak && mReadLineStart < mReadLineEnd)
+		{
+			auto pos = data + mReadLineStart;
+
+			while (pos != end && (*pos == '\r' || *pos == '\n'))
+			{
+				pos++;
+			}
+
+			mReadLineBreak = pos == end;
+			mReadLineStart = mReadLineScan = pos - data;
+		}
+
+		auto pos = FindLineBreak(data + mReadLineScan, end);
+
+		if (pos == end)
+		{
+			mReadLineScan = mReadLineEnd;
+
+			if (mReadLineEnd - mReadLineStart < MaxReadLineBuffer)
+			{
+				return false;
+			}
+
+			// garbage without line break, hand it out instead of growing forever
+		}
+
+		*line = std::string_view(data + mReadLineStart, pos - (data + mReadLineStart));
+
+		while (pos != end && (*pos == '\r' || *pos == '\n'))
+		{
+			pos++;
+		}
+
+		mReadLineBreak = pos == end && pos != data + mReadLineStart + line->size();
+		mReadLineStart = mReadLineScan = pos - data;
 
 		return true;
 	}
 
 public:
 	virtual bool WriteLine(const Utf8String& cmd) = 0;
-	virtual bool ReadLine(Utf8String* line) = 0;
+
+	// the line stays valid until the next read
+	virtual bool ReadLine(std::string_view* line) = 0;
+
+	// switches the host side of the line, the modem has to be switched first
+	virtual bool SupportsLinkSpeed(std::uint32_t baud) = 0;
+	virtual bool SetLinkSpeed(std::uint32_t baud, bool flowControl) = 0;
+
+	// never blocks, only returns what has already been read
+	bool TryReadLine(std::string_view* line)
+	{
+		return CanReadLine(line);
+	}
 };
 
+// a file mapped into memory for reading and writing
+class PlatformMappedFile
+{
+protected:
+	PlatformMappedFile()
+	{
+		// nothing
+	}
+
+	~PlatformMappedFile()
+	{
+		// nothing
+	}
+public:
+	virtual byte* GetData() = 0;
+	virtual size_t GetSize() const = 0;
+
+	// returns once [offset, offset + size) is on the disk
+	virtual bool Flush(size_t offset, size_t size) = 0;
+};
+
+// creates the file if necessary and grows it to at least size bytes, existing files keep their size
+std::shared_ptr<PlatformMappedFile> OpenMappedFile(const std::filesystem::path&, size_t size);
+
+// a file name for the device behind a port that stays the same when ports are numbered differently
+PlatformString GetPortIdentity(const PlatformString&);
+
 class WaitResetEvent
 {
 protected:
@@ -169,6 +377,126 @@ public:
 
 extern WaitResetEvent ExitReset;
 
+// set from a signal handler, the main loop logs the latency of every stage on its next tick
+extern std::atomic<bool> LatencyReportRequested;
+
+// bounded ring for many producers and one consumer, producers never block each other
+template<typename T>
+class MpscQueue
+{
+private:
+	struct Cell
+	{
+		std::atomic<size_t> Sequence;
+		T Value;
+	};
+
+	std::unique_ptr<Cell[]> mCells;
+	size_t mMask;
+	alignas(64) std::atomic<size_t> mEnqueue = 0;
+	alignas(64) std::atomic<size_t> mDequeue = 0;
+	std::atomic<size_t> mHighWaterMark = 0;
+
+public:
+	MpscQueue(size_t capacity)
+	{
+		size_t size = std::bit_ceil(std::max<size_t>(capacity, 2));
+
+		mCells = std::make_unique<Cell[]>(size);
+		mMask = size - 1;
+
+		for (size_t i = 0; i < size; i++)
+		{
+			mCells[i].Sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	MpscQueue(const MpscQueue&) = delete;
+	MpscQueue& operator=(const MpscQueue&) = delete;
+
+	// returns false if the queue is full, value is left untouched then
+	bool TryPush(T&& value)
+	{
+		size_t pos = mEnqueue.load(std::memory_order_relaxed);
+		Cell* cell;
+
+		while (true)
+		{
+			cell = &mCells[pos & mMask];
+
+			size_t seq = cell->Sequence.load(std::memory_order_acquire);
+			auto diff = (std::ptrdiff_t)(seq - pos);
+
+			if (diff == 0)
+			{
+				if (mEnqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (diff < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = mEnqueue.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell->Value = std::move(value);
+		cell->Sequence.store(pos + 1, std::memory_order_release);
+
+		size_t size = pos + 1 - mDequeue.load(std::memory_order_relaxed);
+		size_t mark = mHighWaterMark.load(std::memory_order_relaxed);
+
+		while (size > mark && !mHighWaterMark.compare_exchange_weak(mark, size, std::memory_order_relaxed))
+		{
+			// retry
+		}
+
+		return true;
+	}
+
+	// consumer only
+	bool TryPop(T* value)
+	{
+		size_t pos = mDequeue.load(std::memory_order_relaxed);
+		Cell& cell = mCells[pos & mMask];
+
+		if (cell.Sequence.load(std::memory_order_acquire) != pos + 1)
+		{
+			return false;
+		}
+
+		*value = std::move(cell.Value);
+		cell.Value = T();
+		cell.Sequence.store(pos + mMask + 1, std::memory_order_release);
+
+		mDequeue.store(pos + 1, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	size_t GetSize() const
+	{
+		size_t dequeue = mDequeue.load(std::memory_order_relaxed);
+		size_t enqueue = mEnqueue.load(std::memory_order_relaxed);
+
+		return enqueue > dequeue ? enqueue - dequeue : 0;
+	}
+
+	size_t GetCapacity() const
+	{
+		return mMask + 1;
+	}
+
+	size_t GetHighWaterMark() const
+	{
+		return mHighWaterMark.load(std::memory_order_relaxed);
+	}
+};
+
 template <class _Rep, class _Period>
 bool WaitExitOrTimeout(const std::chrono::duration<_Rep, _Period>& _Rel_time)
 {
@@ -196,24 +524,17 @@ bool ReadAllText(const T& filename, S& content)
 	return ReadAll(filename, content);
 }
 
-extern std::mutex ConsoleLock;
-
-template<typename... Args>
-void ConsoleOut(Args&&... args)
+template<typename T, typename S>
+bool WriteAllText(const T& filename, const S& content)
 {
-	const std::lock_guard<std::mutex> lock(ConsoleLock);
-
-	(PLATFORMCOUT << ... << args);
+	std::basic_ofstream<typename S::value_type, std::char_traits<typename S::value_type>> strm(filename, std::ios_base::out | std::ios_base::trunc);
 
-	PLATFORMCOUT << std::endl;
-}
-
-template<typename... Args>
-void ConsoleErr(Args&&... args)
-{
-	const std::lock_guard<std::mutex> lock(ConsoleLock);
+	if (!strm)
+	{
+		return false;
+	}
 
-	(PLATFORMCOUT << ... << args);
+	strm << content;
 
-	PLATFORMCOUT << std::endl;
+	return (bool)strm.flush();
 }
\ No newline at end of file
@@ -0,0 +1,118 @@
+// Author: Martin Wetzko
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "SmsReassembler.h"
+
+SmsReassembler::SmsReassembler(size_t maxEntries, std::chrono::steady_clock::duration timeout)
+{
+	mMaxEntries = std::max<size_t>(maxEntries, 1);
+	mTimeout = timeout;
+}
+
+SmsReassembler::Message SmsReassembler::Finish(std::list<Entry>::iterator entry)
+{
+	Message message = { entry->Id.From, entry->DateTime, "", entry->Count < entry->Id.Total, std::move(entry->Indices) };
+
+	for (int i = 0; i < entry->Id.Total; i++)
+	{
+		if (entry->Received[i])
+		{
+			message.Text.append(entry->Parts[i]);
+		}
+		else
+		{
+			message.Text.append("[part ").append(std::to_string(i + 1)).append(" of ").append(std::to_string(entry->Id.Total)).append(" missing]");
+		}
+	}
+
+	mIndex.erase(entry->Id);
+	mEntries.erase(entry);
+
+	return message;
+}
+
+void SmsReassembler::Add(const Utf8String& from, const Utf8String& datetime, const GsmConcatInfo& concat, const Utf8String& text, int index, std::vector<Message>* ready)
+{
+	if (concat.Total < 2 || concat.Sequence < 1 || concat.Sequence > concat.Total)
+	{
+		// not split or a header we can not make sense of
+		ready->push_back({ from, datetime, text, false, { index } });
+		return;
+	}
+
+	Key key = { from, concat.Reference, concat.Total };
+
+	auto found = mIndex.find(key);
+
+	if (found == mIndex.end())
+	{
+		if (mEntries.size() >= mMaxEntries)
+		{
+			ready->push_back(this->Finish(std::prev(mEntries.end())));
+		}
+
+		mEntries.push_front({ key, datetime, std::vector<Utf8String>(concat.Total), std::vector<bool>(concat.Total), {}, 0, std::chrono::steady_clock::now() + mTimeout });
+
+		found = mIndex.emplace(key, mEntries.begin()).first;
+	}
+	else
+	{
+		mEntries.splice(mEntries.begin(), mEntries, found->second);
+	}
+
+	Entry& entry = *found->second;
+
+	int part = concat.Sequence - 1;
+
+	// a repeated part replaces the previous copy, every listing shows the parts still held again
+	if (!entry.Received[part])
+	{
+		entry.Received[part] = true;
+		entry.Count++;
+	}
+
+	entry.Parts[part] = text;
+
+	if (std::find(entry.Indices.begin(), entry.Indices.end(), index) == entry.Indices.end())
+	{
+		entry.Indices.push_back(index);
+	}
+
+	if (part == 0)
+	{
+		entry.DateTime = datetime;
+	}
+
+	if (entry.Count == entry.Id.Total)
+	{
+		ready->push_back(this->Finish(found->second));
+	}
+}
+
+void SmsReassembler::Expire(std::chrono::steady_clock::time_point now, std::vector<Message>* ready)
+{
+	auto it = mEntries.begin();
+
+	while (it != mEntries.end())
+	{
+		auto next = std::next(it);
+
+		if (now >= it->Deadline)
+		{
+			ready->push_back(this->Finish(it));
+		}
+
+		it = next;
+	}
+}
+
+size_t SmsReassembler::GetCount() const
+{
+	return mEntries.size();
+}
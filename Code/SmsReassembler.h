@@ -0,0 +1,67 @@
+// Author: Martin Wetzko
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "Shared.h"
+#include "GsmDecoder.h"
+#include <list>
+
+// joins the parts of concatenated messages, one instance per device
+class SmsReassembler
+{
+public:
+	struct Message
+	{
+		Utf8String From;
+		Utf8String DateTime;
+		Utf8String Text;
+		bool Partial;
+
+		// where the parts are stored on the SIM card, deleted once the message is stored
+		std::vector<int> Indices;
+	};
+
+private:
+	struct Key
+	{
+		Utf8String From;
+		int Reference;
+		int Total;
+
+		auto operator<=>(const Key&) const = default;
+	};
+
+	struct Entry
+	{
+		Key Id;
+		Utf8String DateTime;
+		std::vector<Utf8String> Parts;
+		std::vector<bool> Received;
+		std::vector<int> Indices;
+		int Count;
+		std::chrono::steady_clock::time_point Deadline;
+	};
+
+	// most recently used first
+	std::list<Entry> mEntries;
+	std::map<Key, std::list<Entry>::iterator> mIndex;
+	size_t mMaxEntries;
+	std::chrono::steady_clock::duration mTimeout;
+
+	Message Finish(std::list<Entry>::iterator);
+
+public:
+	SmsReassembler(size_t, std::chrono::steady_clock::duration);
+
+	// appends whatever is ready to be delivered, complete or evicted, parts held back stay on the SIM card at their index
+	void Add(const Utf8String&, const Utf8String&, const GsmConcatInfo&, const Utf8String&, int, std::vector<Message>*);
+	void Expire(std::chrono::steady_clock::time_point, std::vector<Message>*);
+	size_t GetCount() const;
+};
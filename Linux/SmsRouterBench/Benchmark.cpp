@@ -0,0 +1,728 @@
+// Author: Martin Wetzko
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "Shared.h"
+#include "Logger.h"
+#include "SIM800C.h"
+#include "GsmDecoder.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <random>
+
+// every allocation of the process is counted, the benchmarks run on the main thread only
+std::atomic<std::uint64_t> AllocCount = 0;
+std::atomic<std::uint64_t> AllocBytes = 0;
+
+// malloc for the plain forms, aligned_alloc wants the size rounded up to the alignment
+void* CountedAlloc(size_t size, size_t alignment)
+{
+	AllocCount.fetch_add(1, std::memory_order_relaxed);
+	AllocBytes.fetch_add(size, std::memory_order_relaxed);
+
+	size = size > 0 ? size : 1;
+
+	if (alignment <= alignof(std::max_align_t))
+	{
+		return std::malloc(size);
+	}
+
+	return std::aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+}
+
+void* operator new(size_t size)
+{
+	if (void* ptr = CountedAlloc(size, 0))
+	{
+		return ptr;
+	}
+
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	if (void* ptr = CountedAlloc(size, (size_t)alignment))
+	{
+		return ptr;
+	}
+
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return CountedAlloc(size, 0);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return CountedAlloc(size, 0);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return CountedAlloc(size, (size_t)alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return CountedAlloc(size, (size_t)alignment);
+}
+
+// kept out of line, inlined into a delete gcc sees free on a pointer from new and warns
+__attribute__((noinline)) void CountedFree(void* ptr)
+{
+	std::free(ptr);
+}
+
+// every form ends in free, aligned_alloc memory included
+void operator delete(void* ptr) noexcept
+{
+	CountedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	CountedFree(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	CountedFree(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+	CountedFree(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+	CountedFree(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+	CountedFree(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept
+{
+	CountedFree(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept
+{
+	CountedFree(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	CountedFree(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+	CountedFree(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	CountedFree(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	CountedFree(ptr);
+}
+
+struct PduSample
+{
+	const char* Name;
+	const char* PDU;
+};
+
+// SMS-DELIVER as listed by AT+CMGL=4, all from the same SMSC and sender
+const PduSample PduCorpus[] =
+{
+	// 33 septets
+	{ "gsm7", "07911326040000F0040B911346610089F600001210625174048021C8329BFD6681E6E53228FFAE83C274100EDE060140747419340E9B0B21" },
+	// 157 septets with escaped characters, a verification code message
+	{ "gsm7-long", "07911326040000F0040B911346610089F60000121062517404809DD9775D0EB297E569737A1CA6A7DF6ED0F84D2E83D273100D27CBC5662E50920E2AE3E16979790E4ABB413118A89D76D7E9E5B90B447C83DC6F3A688E0ECBCBA0341D744FD3D1A0B03BFF769759A0775D0E9AD3C36633E89E66B341EEB2BD2C0785E76B90F92D07A5E92E50B45E9ED3D36FF7FC071A86D96CD08A9603CD60A0986C46ABD96EA00D4F4603" },
+	// latin, chinese and cyrillic
+	{ "ucs2", "07911326040000F0040B911346610089F6000812106251740480240047007200FC0065007A006900204F60597D002020AC0020041F04400438043204350442" },
+	// part 1 of 2 with a concatenation header
+	{ "gsm7-udh", "07911326040000F0440B911346610089F6000012106251740480A00500032A0201A061391DF47697416F33280C1ABFDDE330BDEC0ED3CB6450BB3C9F87CF65101D1DA683C661B93C5D9E83C2A0FABC2C0791C3F430085D0E93CB7217081A96D3416F7719F43683C2A0F1DB3D0ED3CBEE30BD4C06B5CBF379F85C06D1D1613A681C96CBD3E539280CAACFCB7210394C0F83D0E530B92C7781A061391DF47697416F33280C1ABFDD" },
+	// part 2 of 2 with a concatenation header
+	{ "ucs2-udh", "07911326040000F0440B911346610089F60008121062517404802C0500032A02027B2C4E8C90E85206002020130020007A0077006500690074006500720020005400650069006C" },
+	// one byte relative validity period
+	{ "vp-relative", "07911326040000F0140B911346610089F6000012106251740480A718D2323B4C4FDBCB207B989D26A7E97910BC2C4FBFC9" },
+	// seven byte absolute validity period
+	{ "vp-absolute", "07911326040000F01C0B911346610089F6000012106251740480121062517404801841F1FCCDAED3CB207B989D26A7E97910BC2C4FBFC9" },
+	// cut off in the user data
+	{ "bad-truncated", "07911326040000F0040B911346610089F600001210625174048021C8329BFD6681E6E532" },
+	// odd number of digits
+	{ "bad-odd", "07911326040000F0040B911346610089F600001210625174048021C8329BFD6681E6E53228F" },
+	// not hexadecimal
+	{ "bad-hex", "07911326040000F0040B911346610089F600001210625174048021C8329BFD6681E6E53228XX" },
+	// 8 bit data is not forwarded
+	{ "bad-binary", "07911326040000F0040B911346610089F600041210625174048004DEADBEEF" },
+};
+
+// header bytes in front of the user data of the corpus entries without header and validity period
+const size_t PduUserDataOffset = 27;
+
+// what the modem sends while listing and between commands, delivered in small reads like a serial line
+const char* SerialStream =
+	"\r\n+CMTI: \"SM\",3\r\n"
+	"\r\n+CMGL: 1,1,,33\r\n07911326040000F0040B911346610089F600001210625174048021C8329BFD6681E6E53228FFAE83C274100EDE060140747419340E9B0B21\r\n"
+	"\r\n+CMGL: 2,1,,56\r\n07911326040000F0040B911346610089F6000812106251740480240047007200FC0065007A006900204F60597D002020AC0020041F04400438043204350442\r\n"
+	"\r\nOK\r\n"
+	"\r\n+CREG: 1\r\n"
+	"\r\nRING\r\n"
+	"\r\n+CLIP: \"+4917012345678\",145,\"\",0,\"\",0\r\n";
+
+const size_t SerialReadSize = 32;
+
+// a full SIM card as answered to AT+CMGL=4, the long corpus entries over and over
+std::string MakeSimListing(int count)
+{
+	const char* pdus[] = { PduCorpus[1].PDU, PduCorpus[3].PDU, PduCorpus[2].PDU, PduCorpus[4].PDU };
+	std::string listing;
+
+	for (int i = 0; i < count; i++)
+	{
+		std::string_view pdu = pdus[i % std::size(pdus)];
+
+		// the length leaves out the SMSC address
+		listing += "\r\n+CMGL: " + std::to_string(i + 1) + ",1,," + std::to_string(pdu.size() / 2 - 8) + "\r\n";
+		listing += pdu;
+		listing += "\r\n";
+	}
+
+	listing += "\r\nOK\r\n";
+
+	return listing;
+}
+
+const int SimListingCount = 40;
+
+// feeds the line buffer of the base class without a device
+class BenchSerial : public PlatformSerial
+{
+public:
+	void Feed(std::string_view data)
+	{
+		while (data.size() > 0)
+		{
+			std::uint32_t num;
+			auto buffer = this->PrepareRead(&num);
+			num = std::min(num, (std::uint32_t)data.size());
+
+			std::memcpy(buffer, data.data(), num);
+
+			this->CommitRead(num);
+			data.remove_prefix(num);
+		}
+	}
+
+	bool WriteLine(const Utf8String&) override
+	{
+		return true;
+	}
+
+	bool ReadLine(std::string_view* line) override
+	{
+		return this->TryReadLine(line);
+	}
+
+	bool SupportsLinkSpeed(std::uint32_t) override
+	{
+		return false;
+	}
+
+	bool SetLinkSpeed(std::uint32_t, bool) override
+	{
+		return false;
+	}
+};
+
+std::chrono::milliseconds BenchTime = 500ms;
+std::string_view BenchFilter;
+
+// keeps the compiler from dropping a result nobody reads
+template<typename T>
+inline void KeepResult(const T& value)
+{
+	asm volatile("" : : "r"(&value) : "memory");
+}
+
+template<typename F>
+void RunBenchmark(const Utf8String& name, F&& func)
+{
+	if (BenchFilter.size() > 0 && name.find(BenchFilter) == Utf8String::npos)
+	{
+		return;
+	}
+
+	// grows the batch until it takes a tenth of the time, this also warms up caches and lazy statics
+	std::uint64_t iterations = 1;
+
+	while (true)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (std::uint64_t i = 0; i < iterations; i++)
+		{
+			func();
+		}
+
+		auto elapsed = std::chrono::steady_clock::now() - start;
+
+		if (elapsed >= BenchTime / 10 || iterations >= ((std::uint64_t)1 << 32))
+		{
+			iterations = std::max<std::uint64_t>(iterations, (std::uint64_t)(iterations * (std::chrono::duration<double>(BenchTime) / elapsed)));
+			break;
+		}
+
+		iterations *= 10;
+	}
+
+	auto allocs = AllocCount.load();
+	auto bytes = AllocBytes.load();
+	auto start = std::chrono::steady_clock::now();
+
+	for (std::uint64_t i = 0; i < iterations; i++)
+	{
+		func();
+	}
+
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	allocs = AllocCount.load() - allocs;
+	bytes = AllocBytes.load() - bytes;
+
+	std::printf("%-44s %12llu %12.1f ns/op %10.1f B/op %8.2f allocs/op\n", name.c_str(), (unsigned long long)iterations,
+		std::chrono::duration<double, std::nano>(elapsed).count() / iterations, (double)bytes / iterations, (double)allocs / iterations);
+	std::fflush(stdout);
+}
+
+// septets packed least significant bit first like in the user data
+std::vector<byte> PackSeptets(const std::vector<byte>& septets)
+{
+	std::vector<byte> packed((septets.size() * 7 + 7) / 8);
+
+	for (size_t i = 0; i < septets.size(); i++)
+	{
+		for (int bit = 0; bit < 7; bit++)
+		{
+			if (septets[i] & (1 << bit))
+			{
+				packed[(i * 7 + bit) / 8] |= (byte)(1 << ((i * 7 + bit) % 8));
+			}
+		}
+	}
+
+	return packed;
+}
+
+// one septet after the other from its bit position, each one rendered on its own by the decoder
+bool DecodeGsmSeptetsReference(const std::vector<byte>& packed, int chars, int skip, Utf8String* decoded)
+{
+	decoded->clear();
+
+	size_t count = std::min((size_t)chars, packed.size() * 8 / 7);
+	bool escape = false;
+
+	for (size_t i = (size_t)skip; i < count; i++)
+	{
+		int code = 0;
+
+		for (int bit = 0; bit < 7; bit++)
+		{
+			code |= ((packed[(i * 7 + bit) / 8] >> ((i * 7 + bit) % 8)) & 1) << bit;
+		}
+
+		// the escape page keeps escaping on another escape
+		if (code == 0x1B)
+		{
+			escape = true;
+			continue;
+		}
+
+		auto single = PackSeptets(escape ? std::vector<byte>{ 0x1B, (byte)code } : std::vector<byte>{ (byte)code });
+
+		Utf8String part;
+		DecodeGsmSeptetData(single.data(), single.data() + single.size(), escape ? 2 : 1, 0, &part);
+
+		decoded->append(part);
+		escape = false;
+	}
+
+	return count == (size_t)chars;
+}
+
+// random streams against the reference with every skip a header can cause, plus the cases the carry loop got wrong
+bool CheckDecodeGsmSeptetData()
+{
+	std::mt19937 random(7);
+	size_t failures = 0;
+	size_t runs = 0;
+
+	auto check = [&](const std::vector<byte>& packed, int chars, int skip, const char* what)
+		{
+			Utf8String expected;
+			Utf8String actual;
+
+			bool expectedOk = DecodeGsmSeptetsReference(packed, chars, skip, &expected);
+			bool actualOk = DecodeGsmSeptetData(packed.data(), packed.data() + packed.size(), chars, skip, &actual);
+
+			runs++;
+
+			if (expected != actual || expectedOk != actualOk)
+			{
+				if (failures++ < 5)
+				{
+					std::printf("DecodeGsmSeptetData differs (%s): %d septets, skip %d, \"%s\" instead of \"%s\"\n", what, chars, skip, actual.c_str(), expected.c_str());
+				}
+			}
+		};
+
+	for (int round = 0; round < 2000; round++)
+	{
+		// '@' and the escape are the septets the old decoder stumbled over, so they come often
+		std::vector<byte> septets(random() % 170);
+
+		for (auto& septet : septets)
+		{
+			auto pick = random() % 10;
+			septet = pick == 0 ? 0 : pick == 1 ? 0x1B : (byte)(random() % 128);
+		}
+
+		auto packed = PackSeptets(septets);
+
+		for (int skip = 0; skip <= 6; skip++)
+		{
+			check(packed, (int)septets.size(), skip, "random");
+
+			// more septets than the data holds
+			check(packed, (int)septets.size() + 1 + (int)(random() % 8), skip, "truncated");
+		}
+	}
+
+	// '@' at 8k+7 is all zero bits and got lost in the carry of the old decoder
+	std::vector<byte> at = { 'A', 'B', 'C', 'D', 'E', 'F', 'G', 0, 'H', 'I', 'J', 'K', 'L', 'M', 'N', 0 };
+	auto packedAt = PackSeptets(at);
+
+	Utf8String decodedAt;
+	DecodeGsmSeptetData(packedAt.data(), packedAt.data() + packedAt.size(), (int)at.size(), 0, &decodedAt);
+
+	runs++;
+
+	if (decodedAt != "ABCDEFG@HIJKLMN@")
+	{
+		failures++;
+		std::printf("DecodeGsmSeptetData drops '@' at 8k+7: \"%s\"\n", decodedAt.c_str());
+	}
+
+	// a 3 byte header takes 24 bits, the text starts at septet 4 behind 4 fill bits, rounding gave 3
+	std::vector<byte> udh = { 0, 0, 0, 0, 'T', 'e', 'x', 't' };
+	auto packedUdh = PackSeptets(udh);
+	packedUdh[0] = 0x02;
+	packedUdh[1] = 0x70;
+	packedUdh[2] = 0x00;
+
+	char udl[3];
+	std::snprintf(udl, sizeof(udl), "%02X", (unsigned int)udh.size());
+
+	Utf8String pdu = Utf8String("07911326040000F0440B911346610089F6000012106251740480") + udl;
+
+	for (auto b : packedUdh)
+	{
+		char hex[3];
+		std::snprintf(hex, sizeof(hex), "%02X", (unsigned int)b);
+		pdu.append(hex);
+	}
+
+	Utf8String from;
+	Utf8String datetime;
+	Utf8String message;
+	GsmConcatInfo concat;
+
+	runs++;
+
+	if (!ParseGsmPDU(pdu, &from, &datetime, &message, &concat) || message != "Text")
+	{
+		failures++;
+		std::printf("ParseGsmPDU skips the header wrong: \"%s\"\n", message.c_str());
+	}
+
+	std::printf("%-44s %12llu checks %s\n", "DecodeGsmSeptetData/reference", (unsigned long long)runs, failures == 0 ? "ok" : "FAILED");
+	std::fflush(stdout);
+
+	return failures == 0;
+}
+
+void BenchDecodeHexToBin()
+{
+	for (auto& sample : PduCorpus)
+	{
+		std::array<byte, 512> decoded;
+		std::string_view pdu = sample.PDU;
+
+		RunBenchmark(Utf8String("DecodeHexToBin/") + sample.Name, [&]()
+			{
+				size_t num = 0;
+				bool ok = DecodeHexToBin(pdu, decoded, &num);
+
+				KeepResult(ok);
+				KeepResult(decoded);
+			});
+	}
+}
+
+void BenchDecodeGsmSeptetData()
+{
+	for (auto name : { "gsm7", "gsm7-long", "vp-relative", "gsm7-udh" })
+	{
+		auto sample = std::find_if(std::begin(PduCorpus), std::end(PduCorpus), [&](const PduSample& s) { return std::string_view(s.Name) == name; });
+
+		std::array<byte, 512> data;
+		size_t num = 0;
+		DecodeHexToBin(sample->PDU, data, &num);
+
+		// the validity period shifts the user data
+		size_t offset = PduUserDataOffset + (std::string_view(name) == "vp-relative" ? 1 : 0);
+		int chars = data[offset - 1];
+
+		// the header and its fill bits are skipped like ParseGsmPDU does
+		int skip = std::string_view(name) == "gsm7-udh" ? ((data[offset] + 1) * 8 + 6) / 7 : 0;
+
+		Utf8String decoded;
+
+		RunBenchmark(Utf8String("DecodeGsmSeptetData/") + name, [&]()
+			{
+				decoded.clear();
+
+				bool ok = DecodeGsmSeptetData(data.data() + offset, data.data() + num, chars, skip, &decoded);
+
+				KeepResult(ok);
+				KeepResult(decoded);
+			});
+	}
+}
+
+void BenchDecodeUcs2Data()
+{
+	auto sample = std::find_if(std::begin(PduCorpus), std::end(PduCorpus), [](const PduSample& s) { return std::string_view(s.Name) == "ucs2"; });
+
+	std::array<byte, 512> data;
+	size_t num = 0;
+	DecodeHexToBin(sample->PDU, data, &num);
+
+	// the raw user data, the way ParseGsmPDU hands it over
+	auto ud = data.data() + PduUserDataOffset;
+
+	RunBenchmark("DecodeUcs2Data/ucs2", [&]()
+		{
+			Utf8String decoded;
+			bool ok = DecodeUcs2Data(ud, data.data() + num, &decoded);
+
+			KeepResult(ok);
+			KeepResult(decoded);
+		});
+
+	// a full message of cyrillic words, the widest case of the fast path
+	std::vector<byte> cyrillic;
+
+	for (int i = 0; i < 70; i++)
+	{
+		char16_t c = (i % 7 == 6) ? u' ' : (char16_t)(0x0430 + i % 32);
+
+		cyrillic.push_back((byte)(c >> 8));
+		cyrillic.push_back((byte)(c & 0xFF));
+	}
+
+	RunBenchmark("DecodeUcs2Data/cyrillic", [&]()
+		{
+			Utf8String decoded;
+			bool ok = DecodeUcs2Data(cyrillic.data(), cyrillic.data() + cyrillic.size(), &decoded);
+
+			KeepResult(ok);
+			KeepResult(decoded);
+		});
+}
+
+void BenchParseGsmDateTime()
+{
+	// the time stamp octets of the corpus, 2021-01-26 15:47:40 at +02:00
+	const byte timestamp[] = { 0x12, 0x10, 0x62, 0x51, 0x74, 0x04, 0x80 };
+
+	RunBenchmark("ParseGsmDateTime", [&]()
+		{
+			Utf8String datetime;
+			bool ok = ParseGsmDateTime(timestamp, timestamp + sizeof(timestamp), &datetime);
+
+			KeepResult(ok);
+			KeepResult(datetime);
+		});
+}
+
+void BenchParseGsmPDU()
+{
+	for (auto& sample : PduCorpus)
+	{
+		Utf8String pdu = sample.PDU;
+
+		RunBenchmark(Utf8String("ParseGsmPDU/") + sample.Name, [&]()
+			{
+				Utf8String from;
+				Utf8String datetime;
+				Utf8String message;
+				GsmConcatInfo concat;
+
+				bool ok = ParseGsmPDU(pdu, &from, &datetime, &message, &concat);
+
+				KeepResult(ok);
+				KeepResult(message);
+			});
+	}
+}
+
+void BenchCanReadLine()
+{
+	std::string listing = MakeSimListing(SimListingCount);
+
+	struct
+	{
+		const char* Name;
+		std::string_view Stream;
+		size_t ReadSize;
+		bool Backlog;
+	} cases[] =
+	{
+		{ "stream", SerialStream, SerialReadSize, false },
+		{ "listing-64", listing, 64, false },
+		{ "listing-256", listing, 256, false },
+		// the main loop was busy, the whole listing waits in the buffer before the first line is taken
+		{ "listing-backlog", listing, 256, true },
+	};
+
+	for (auto& c : cases)
+	{
+		BenchSerial serial;
+
+		// one op is the whole stream, read by read with every complete line taken out after each
+		RunBenchmark(Utf8String("PlatformSerial::CanReadLine/") + c.Name, [&]()
+			{
+				std::string_view line;
+				size_t lines = 0;
+
+				for (size_t pos = 0; pos < c.Stream.size(); pos += c.ReadSize)
+				{
+					serial.Feed(c.Stream.substr(pos, c.ReadSize));
+
+					while (!c.Backlog && serial.TryReadLine(&line))
+					{
+						lines++;
+					}
+				}
+
+				while (serial.TryReadLine(&line))
+				{
+					lines++;
+				}
+
+				KeepResult(lines);
+			});
+	}
+}
+
+void BenchOnCommand()
+{
+	auto serial = std::make_shared<BenchSerial>();
+
+	SIM800C sim(std::filesystem::path(), PLATFORMSTR("bench"), serial);
+
+	// URCs of an idle modem, the handlers only remember what they saw until the device is ready
+	const std::pair<const char*, const char*> lines[] =
+	{
+		{ "+CMTI", "+CMTI: \"SM\",12" },
+		{ "+CREG", "+CREG: 1" },
+		{ "+CPIN", "+CPIN: READY" },
+		{ "+CRING", "+CRING: VOICE" },
+		{ "unknown", "+CSQ: 21,0" },
+		{ "plain", "RING" },
+	};
+
+	for (auto& [name, line] : lines)
+	{
+		std::string_view view = line;
+
+		RunBenchmark(Utf8String("SIM800C::OnCommand/") + name, [&]()
+			{
+				sim.ProcessLine(view);
+			});
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::setlocale(LC_ALL, "C.UTF-8");
+
+	// the handlers log, only the formatting guard is measured
+	MinLogLevel = LogLevel::Error;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string_view arg = argv[i];
+
+		if (arg == "-time" && i + 1 < argc)
+		{
+			BenchTime = std::chrono::milliseconds(std::atoi(argv[++i]));
+		}
+		else if (arg == "-filter" && i + 1 < argc)
+		{
+			BenchFilter = argv[++i];
+		}
+		else
+		{
+			std::printf("Usage: %s [-time <milliseconds per benchmark>] [-filter <name part>]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// a wrong result is worse than a slow one
+	if (!CheckDecodeGsmSeptetData())
+	{
+		return 2;
+	}
+
+	BenchDecodeHexToBin();
+	BenchDecodeGsmSeptetData();
+	BenchDecodeUcs2Data();
+	BenchParseGsmDateTime();
+	BenchParseGsmPDU();
+	BenchCanReadLine();
+	BenchOnCommand();
+
+	return 0;
+}
@@ -14,25 +14,9 @@ while true; do
 
   if ! pidof SmsRouterPi.out >/dev/null; then
 
-    # start app
+    # start app, it rotates its log file itself, output before the log is opened is appended too
 
-    echo "---Start App---" >$logfile
-
-    $exefile >>$logfile &
-
-  fi
-
-  if [ -f $logfile ]; then
-
-    # check log file size, max 10mb
-
-    if [ $(wc -c $logfile | awk '{print $1}') -gt 10485760 ]; then
-
-      # reset logfile
-
-      echo "" >$logfile
-
-    fi
+    $exefile -logfile $logfile >>$logfile 2>&1 &
 
   fi
 
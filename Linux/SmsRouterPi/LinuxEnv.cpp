@@ -8,12 +8,30 @@
 // SOFTWARE.
 
 #include "Shared.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "MailSink.h"
 #include "SIM800C.h"
-#include <codecvt>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <openssl/ssl.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+#include <set>
+#include <thread>
+#include <atomic>
 
 SafeFdPtr ExclusiveProcess;
+SafeFdPtr ExitEvent;
 
 void CtrlHandler(int);
+void ReportHandler(int);
 
 void SetControlHandler()
 {
@@ -34,12 +52,23 @@ void SetControlHandler()
 			sigaction(num, &new_action, NULL);
 		}
 	}
+
+	// kill -USR1 logs the latency report
+	new_action.sa_handler = ReportHandler;
+	new_action.sa_flags = SA_RESTART;
+
+	sigaction(SIGUSR1, &new_action, NULL);
 }
 
+// the benchmark links this file with a main of its own
+#ifndef SMSROUTER_BENCHMARK
 int main(int argc, char** argv)
 {
 	std::setlocale(LC_ALL, "C.UTF-8");
 
+	// never read, stays readable once signaled so every poll() sees it
+	ExitEvent = SafeFdPtr(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+
 	SetControlHandler();
 
 	std::vector<PlatformString> vec;
@@ -58,6 +87,7 @@ int main(int argc, char** argv)
 
 	return res;
 }
+#endif
 
 bool CheckExclusiveProcess(const std::filesystem::path& exe)
 {
@@ -75,6 +105,70 @@ bool CheckExclusiveProcess(const std::filesystem::path& exe)
 	return false;
 }
 
+const int ModemVendor = 0x1A86;
+const int ModemProduct = 0x7523;
+
+// the usb device owning a sysfs node is the first parent with ids
+bool IsUsbDevice(std::filesystem::path path, int vendor, int product)
+{
+	for (int i = 0; i < 8 && path.has_relative_path(); i++, path = path.parent_path())
+	{
+		Utf8String strVendor;
+		Utf8String strProduct;
+
+		if (ReadAllText(path / "idVendor", strVendor) && ReadAllText(path / "idProduct", strProduct))
+		{
+			return std::stoi(strVendor, nullptr, 16) == vendor && std::stoi(strProduct, nullptr, 16) == product;
+		}
+	}
+
+	return false;
+}
+
+// ids and serial number of the usb device, or the hub ports it sits behind when it has no serial number like the CH340
+PlatformString GetPortIdentity(const PlatformString& port)
+{
+	auto name = std::filesystem::path(port).filename();
+
+	try
+	{
+		auto path = std::filesystem::canonical(std::filesystem::path("/sys/class/tty") / name / "device");
+
+		for (int i = 0; i < 8 && path.has_relative_path(); i++, path = path.parent_path())
+		{
+			Utf8String strVendor;
+			Utf8String strProduct;
+
+			if (!ReadAllText(path / "idVendor", strVendor) || !ReadAllText(path / "idProduct", strProduct))
+			{
+				continue;
+			}
+
+			Utf8String serial;
+			if (!ReadAllText(path / "serial", serial) || serial == "")
+			{
+				serial = path.filename().string();
+			}
+
+			// sysfs values end with a line break
+			auto trim = [](Utf8String value) { return value.erase(value.find_last_not_of(" \t\r\n") + 1); };
+
+			auto identity = "usb-" + trim(strVendor) + "-" + trim(strProduct) + "-" + trim(serial);
+
+			std::replace_if(identity.begin(), identity.end(), [](Utf8Char c) { return !std::isalnum((unsigned char)c) && c != '-' && c != '.'; }, '_');
+
+			return Utf8ToPlatformString(identity);
+		}
+	}
+	catch (const std::exception&)
+	{
+		// nothing
+	}
+
+	// not on usb, e.g. the pseudo terminals of the simulator
+	return name.wstring();
+}
+
 std::vector<PlatformString> GetPorts(int vendor, int product)
 {
 	std::vector<PlatformString> names;
@@ -94,18 +188,9 @@ std::vector<PlatformString> GetPorts(int vendor, int product)
 						std::filesystem::path symlink_points_at = read_symlink(it);
 						std::filesystem::path canonical_path = std::filesystem::canonical(p / symlink_points_at);
 
-						std::filesystem::path idVendorPath = canonical_path / ".." / ".." / "idVendor";
-						std::filesystem::path idProductPath = canonical_path / ".." / ".." / "idProduct";
-
-						Utf8String strVendor;
-						Utf8String strProduct;
-
-						if (ReadAllText(idVendorPath, strVendor) && ReadAllText(idProductPath, strProduct))
+						if (IsUsbDevice(canonical_path, vendor, product))
 						{
-							if (std::stoi(strVendor, nullptr, 16) == vendor && std::stoi(strProduct, nullptr, 16) == product)
-							{
-								names.push_back(Utf8ToPlatformString("/dev" / it.path().filename()));
-							}
+							names.push_back(Utf8ToPlatformString("/dev" / it.path().filename()));
 						}
 					}
 				}
@@ -124,160 +209,1214 @@ std::vector<PlatformString> GetPorts(int vendor, int product)
 	return names;
 }
 
-void HandleTimer()
+// ports of plugged in modems, kept up to date by kernel uevents after one scan at startup
+std::set<PlatformString> HotplugPorts;
+std::mutex HotplugLock;
+SafeFdPtr HotplugSocket;
+std::thread HotplugThread;
+
+void ScanHotplugPorts()
 {
-	auto ports = GetPorts(0x1A86, 0x7523);
+	auto ports = GetPorts(ModemVendor, ModemProduct);
 
-	for (auto it : ports)
-	{
-		EnsureCommPort(it);
-	}
+	const std::lock_guard<std::mutex> lock(HotplugLock);
+
+	HotplugPorts = std::set<PlatformString>(ports.begin(), ports.end());
 }
 
-PlatformString UCS2ToPlatformString(const std::u16string& str)
+void OnHotplugEvent(std::string_view action, std::string_view subsystem, std::string_view devpath, std::string_view devname)
 {
-	// on linux wstring is double u16string and big endian instead of little endian
-	std::wstring_convert<std::codecvt_utf16<wchar_t, 0x10ffff, std::little_endian>, wchar_t> conv;
-	return conv.from_bytes((const char*)str.c_str(), (const char*)(str.c_str() + str.size()));
+	if (subsystem != "tty" || devname == "")
+	{
+		return;
+	}
+
+	auto port = Utf8ToPlatformString("/dev/" + Utf8String(devname));
+
+	if (action == "add")
+	{
+		try
+		{
+			if (!IsUsbDevice(std::filesystem::path("/sys") / devpath.substr(1), ModemVendor, ModemProduct))
+			{
+				return;
+			}
+		}
+		catch (const std::exception&)
+		{
+			return;
+		}
+
+		{
+			const std::lock_guard<std::mutex> lock(HotplugLock);
+
+			HotplugPorts.insert(port);
+		}
+
+		ConsoleOut(PLATFORMSTR("Modem plugged in at "), port);
+
+		EnsureCommPort(port);
+	}
+	else if (action == "remove")
+	{
+		const std::lock_guard<std::mutex> lock(HotplugLock);
+
+		if (HotplugPorts.erase(port) > 0)
+		{
+			ConsoleOut(PLATFORMSTR("Modem removed from "), port);
+		}
+	}
 }
 
-class PlatformSerialLinux :public PlatformSerial
+void ProcessHotplug()
 {
-private:
-	SafeFdPtr mCom;
-private:
-	bool WaitReadLoop()
+	std::vector<char> buffer(16384);
+
+	pollfd fds[] = { { HotplugSocket, POLLIN, 0 }, { ExitEvent, POLLIN, 0 } };
+
+	while (true)
 	{
-		for (int i = 0; i < 150; i++)
+		int res = poll(fds, 2, -1);
+
+		if (res < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (res <= 0 || (fds[1].revents & POLLIN))
 		{
-			int num = read(mCom, mReadBuffer, mReadBufferNum);
+			break;
+		}
 
-			if (num > 0)
+		sockaddr_nl sender = { 0 };
+		socklen_t senderSize = sizeof(sender);
+
+		auto num = recvfrom(HotplugSocket, buffer.data(), buffer.size(), 0, (sockaddr*)&sender, &senderSize);
+
+		if (num < 0)
+		{
+			if (errno == ENOBUFS)
 			{
-				mReadLineBuffer.append(mReadBuffer, num);
-				return true;
+				// events were lost, start over from sysfs
+				ScanHotplugPorts();
 			}
-			else if (num == 0)
+			else if (errno != EAGAIN && errno != EINTR)
 			{
-				if (WaitExitOrTimeout(100ms))
-				{
-					break;
-				}
+				break;
+			}
+
+			continue;
+		}
+
+		// only the kernel is trusted
+		if (sender.nl_pid != 0)
+		{
+			continue;
+		}
+
+		// "action@devpath" followed by KEY=value, all separated by zeros
+		std::string_view action;
+		std::string_view subsystem;
+		std::string_view devpath;
+		std::string_view devname;
+
+		std::string_view message(buffer.data(), num);
+
+		for (size_t pos = 0; pos < message.size();)
+		{
+			auto end = message.find('\0', pos);
+
+			if (end == std::string_view::npos)
+			{
+				end = message.size();
+			}
+
+			auto field = message.substr(pos, end - pos);
+
+			if (field.starts_with("ACTION="))
+			{
+				action = field.substr(7);
 			}
-			else
+			else if (field.starts_with("SUBSYSTEM="))
 			{
-				break;
+				subsystem = field.substr(10);
+			}
+			else if (field.starts_with("DEVPATH="))
+			{
+				devpath = field.substr(8);
+			}
+			else if (field.starts_with("DEVNAME="))
+			{
+				devname = field.substr(8);
 			}
+
+			pos = end + 1;
 		}
 
-		return false;
+		if (devpath.starts_with("/"))
+		{
+			OnHotplugEvent(action, subsystem, devpath, devname);
+		}
 	}
-public:
-	PlatformSerialLinux(const SafeFdPtr& com) :PlatformSerial()
+}
+
+bool StartHotplugMonitor()
+{
+	HotplugSocket = SafeFdPtr(socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT));
+
+	if (!HotplugSocket)
 	{
-		mCom = com;
+		return false;
 	}
 
-	bool WriteLine(const Utf8String& cmd)
+	sockaddr_nl addr = { 0 };
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1; // kernel events, not the ones udev sends after processing them
+
+	if (::bind(HotplugSocket, (sockaddr*)&addr, sizeof(addr)) != 0)
 	{
-		auto str = cmd;
-		str.append("\n");
+		HotplugSocket = SafeFdPtr();
+		return false;
+	}
 
-		auto sz = str.size() * sizeof(Utf8Char);
+	// events arriving during the scan wait in the socket
+	ScanHotplugPorts();
 
-		return write(mCom, str.c_str(), sz) == (ssize_t)sz;
+	HotplugThread = std::thread(ProcessHotplug);
+
+	return true;
+}
+
+void StopHotplugMonitor()
+{
+	if (HotplugThread.joinable())
+	{
+		HotplugThread.join();
 	}
+}
+
+SafeFdPtr MetricsSocket = SafeFdPtr(-1);
+std::thread MetricsThread;
+
+// one scrape at a time, a client that stalls is dropped after the timeout
+void ServeMetricsClient(int fd)
+{
+	timeval timeout = { 2, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	Utf8String request;
+	char buffer[1024];
 
-	bool ReadLine(Utf8String* line)
+	while (request.find("\r\n\r\n") == Utf8String::npos && request.size() < 8192)
 	{
-		while (!WaitExitOrTimeout(0ms))
+		auto num = recv(fd, buffer, sizeof(buffer), 0);
+
+		if (num <= 0)
 		{
-			Utf8String str;
-			if (CanReadLine(&str))
-			{
-				line->assign(str);
-				return true;
-			}
+			return;
+		}
 
-			if (!WaitReadLoop())
-			{
-				return false;
-			}
+		request.append(buffer, num);
+	}
+
+	auto response = HandleMetricsRequest(request);
+
+	size_t written = 0;
+
+	while (written < response.size())
+	{
+		auto num = send(fd, response.data() + written, response.size() - written, MSG_NOSIGNAL);
+
+		if (num <= 0)
+		{
+			return;
 		}
 
-		return false;
+		written += num;
 	}
-};
+}
 
-bool GetCommDevice(const std::filesystem::path& root, const PlatformString& port, SIM800C* sim)
+void ProcessMetrics()
 {
-	SafeFdPtr com = SafeFdPtr(open(PlatformStringToUtf8(port).c_str(), O_RDWR));
+	pollfd fds[] = { { MetricsSocket, POLLIN, 0 }, { ExitEvent, POLLIN, 0 } };
 
-	if (com)
+	while (true)
 	{
-		termios tty = { 0 };
+		int res = poll(fds, 2, -1);
 
-		tty.c_cflag = CS8 | CREAD | CLOCAL;
-		tty.c_iflag = IGNPAR | IUTF8;
-		tty.c_cc[VTIME] = 1; // 100ms
-		tty.c_cc[VMIN] = 0;
+		if (res < 0 && errno == EINTR)
+		{
+			continue;
+		}
 
-		cfsetispeed(&tty, B9600);
-		cfsetospeed(&tty, B9600);
+		if (res <= 0 || (fds[1].revents & POLLIN))
+		{
+			break;
+		}
 
-		if (tcsetattr(com, TCSANOW, &tty) == 0)
+		SafeFdPtr client = SafeFdPtr(accept4(MetricsSocket, nullptr, nullptr, SOCK_CLOEXEC));
+
+		if (client)
 		{
-			usleep(10000);
+			ServeMetricsClient(client);
+		}
+	}
+}
 
-			tcflush(com, TCIOFLUSH);
+bool StartMetricsServer(const Utf8String& address, std::uint16_t port)
+{
+	sockaddr_in addr = { 0 };
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+
+	if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1)
+	{
+		return false;
+	}
 
-			*sim = SIM800C(root, port, std::make_shared<PlatformSerialLinux>(com));
+	MetricsSocket = SafeFdPtr(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
 
-			return true;
-		}
+	if (!MetricsSocket)
+	{
+		return false;
 	}
 
-	return false;
+	// a restart must not wait for old connections in TIME_WAIT
+	int reuse = 1;
+	setsockopt(MetricsSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	if (::bind(MetricsSocket, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(MetricsSocket, 8) != 0)
+	{
+		MetricsSocket = SafeFdPtr(-1);
+		return false;
+	}
+
+	MetricsThread = std::thread(ProcessMetrics);
+
+	return true;
 }
 
-uint32_t RtlEnlargedUnsignedDivide(ULARGE_INTEGER Dividend, uint32_t Divisor, uint32_t* Remainder)
+void StopMetricsServer()
 {
-	if (Remainder)
+	if (MetricsThread.joinable())
 	{
-		*Remainder = (uint32_t)(Dividend.QuadPart % Divisor);
+		MetricsThread.join();
 	}
 
-	return (uint32_t)(Dividend.QuadPart / Divisor);
+	MetricsSocket = SafeFdPtr(-1);
 }
 
-int MulDiv(int nNumber, int nNumerator, int nDenominator)
+SafeFdPtr MailSinkSocket = SafeFdPtr(-1);
+SafeFdPtr MailSinkStop = SafeFdPtr(-1);
+std::thread MailSinkThread;
+SSL_CTX* MailSinkTls = nullptr;
+MailSinkOptions MailSinkConfig;
+
+// one thread per connection, finished ones are joined when the next client connects
+std::vector<std::pair<std::thread, std::shared_ptr<std::atomic<bool>>>> MailSinkClients;
+
+// a fresh key and a certificate for 127.0.0.1 and localhost signed by itself, valid for a day
+bool CreateMailSinkCertificate(SSL_CTX* ctx, Utf8String* pem)
 {
-	LARGE_INTEGER Result;
-	int Negative;
+	std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> key(EVP_EC_gen("P-256"), EVP_PKEY_free);
+	std::unique_ptr<X509, decltype(&X509_free)> cert(X509_new(), X509_free);
 
-	Negative = nNumber ^ nNumerator ^ nDenominator;
+	if (!key || !cert)
+	{
+		return false;
+	}
 
-	if (nNumber < 0) nNumber *= -1;
-	if (nNumerator < 0) nNumerator *= -1;
-	if (nDenominator < 0) nDenominator *= -1;
+	X509_set_version(cert.get(), 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(cert.get()), (long)std::time(nullptr));
+	X509_gmtime_adj(X509_getm_notBefore(cert.get()), -60);
+	X509_gmtime_adj(X509_getm_notAfter(cert.get()), 24 * 60 * 60);
+	X509_set_pubkey(cert.get(), key.get());
 
-	Result.QuadPart = Int32x32To64(nNumber, nNumerator) + (nDenominator / 2);
+	auto name = X509_get_subject_name(cert.get());
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+	X509_set_issuer_name(cert.get(), name);
 
-	if (nDenominator > Result.HighPart)
+	X509V3_CTX v3;
+	X509V3_set_ctx_nodb(&v3);
+	X509V3_set_ctx(&v3, cert.get(), cert.get(), nullptr, nullptr, 0);
+
+	auto alt = X509V3_EXT_conf_nid(nullptr, &v3, NID_subject_alt_name, "DNS:localhost,IP:127.0.0.1");
+
+	if (!alt)
 	{
-		Result.LowPart = RtlEnlargedUnsignedDivide(*(PULARGE_INTEGER)&Result, (uint32_t)nDenominator, (uint32_t*)&Result.HighPart);
+		return false;
+	}
 
-		if ((int)Result.LowPart >= 0)
+	X509_add_ext(cert.get(), alt, -1);
+	X509_EXTENSION_free(alt);
+
+	if (X509_sign(cert.get(), key.get(), EVP_sha256()) == 0 || SSL_CTX_use_certificate(ctx, cert.get()) != 1 || SSL_CTX_use_PrivateKey(ctx, key.get()) != 1)
+	{
+		return false;
+	}
+
+	// the transport trusts exactly this one
+	std::unique_ptr<BIO, decltype(&BIO_free)> bio(BIO_new(BIO_s_mem()), BIO_free);
+
+	if (!bio || PEM_write_bio_X509(bio.get(), cert.get()) != 1)
+	{
+		return false;
+	}
+
+	char* data;
+	auto size = BIO_get_mem_data(bio.get(), &data);
+
+	pem->assign(data, size);
+
+	return true;
+}
+
+// waits for more data unless the tls layer already has some, false once the client is gone or the sink stops
+bool ReadMailSinkClient(int fd, SSL* ssl, Utf8String& buffer)
+{
+	if (!ssl || SSL_pending(ssl) == 0)
+	{
+		pollfd fds[] = { { fd, POLLIN, 0 }, { MailSinkStop, POLLIN, 0 } };
+
+		while (poll(fds, 2, -1) < 0)
 		{
-			return (Negative >= 0) ? (int)Result.LowPart : -(int)Result.LowPart;
+			if (errno != EINTR)
+			{
+				return false;
+			}
+		}
+
+		if (fds[1].revents & POLLIN)
+		{
+			return false;
 		}
 	}
 
-	return -1;
+	char data[4096];
+	int num = ssl ? SSL_read(ssl, data, sizeof(data)) : (int)recv(fd, data, sizeof(data), 0);
+
+	if (num <= 0)
+	{
+		return false;
+	}
+
+	buffer.append(data, num);
+
+	return true;
 }
 
-void CtrlHandler(int signum)
+bool WriteMailSinkClient(int fd, SSL* ssl, const Utf8String& data)
 {
-	PLATFORMCOUT << PLATFORMSTR("Received closing event...") << std::endl;
-	ExitReset.Set();
-}
\ No newline at end of file
+	if (MailSinkConfig.Latency.count() > 0)
+	{
+		std::this_thread::sleep_for(MailSinkConfig.Latency);
+	}
+
+	size_t written = 0;
+
+	while (written < data.size())
+	{
+		int num = ssl ? SSL_write(ssl, data.data() + written, (int)(data.size() - written)) : (int)send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+
+		if (num <= 0)
+		{
+			return false;
+		}
+
+		written += num;
+	}
+
+	return true;
+}
+
+void ServeMailSinkClient(SafeFdPtr client)
+{
+	// openssl writes with write(), a client gone away must not kill the process
+	sigset_t pipe;
+	sigemptyset(&pipe);
+	sigaddset(&pipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &pipe, nullptr);
+
+	// a stalled handshake ends as well
+	timeval timeout = { 30, 0 };
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	std::unique_ptr<SSL, decltype(&SSL_free)> ssl(nullptr, SSL_free);
+	MailSinkSession session(MailSinkConfig);
+	Utf8String buffer;
+
+	if (!WriteMailSinkClient(client, nullptr, session.GetGreeting()))
+	{
+		return;
+	}
+
+	while (ReadMailSinkClient(client, ssl.get(), buffer))
+	{
+		size_t pos;
+
+		while ((pos = buffer.find("\r\n")) != Utf8String::npos)
+		{
+			auto line = buffer.substr(0, pos);
+			buffer.erase(0, pos + 2);
+
+			bool startTls;
+			bool close;
+			auto reply = session.HandleLine(line, &startTls, &close);
+
+			if ((reply.size() > 0 && !WriteMailSinkClient(client, ssl.get(), reply)) || close)
+			{
+				return;
+			}
+
+			if (startTls)
+			{
+				// nothing may be pipelined in front of the handshake
+				buffer.clear();
+
+				ssl.reset(SSL_new(MailSinkTls));
+
+				if (!ssl || SSL_set_fd(ssl.get(), client) != 1 || SSL_accept(ssl.get()) != 1)
+				{
+					return;
+				}
+			}
+		}
+	}
+}
+
+void JoinMailSinkClients(bool all)
+{
+	for (auto it = MailSinkClients.begin(); it != MailSinkClients.end();)
+	{
+		if (all || *it->second)
+		{
+			it->first.join();
+			it = MailSinkClients.erase(it);
+		}
+		else
+		{
+			it++;
+		}
+	}
+}
+
+void ProcessMailSink()
+{
+	pollfd fds[] = { { MailSinkSocket, POLLIN, 0 }, { MailSinkStop, POLLIN, 0 } };
+
+	while (true)
+	{
+		int res = poll(fds, 2, -1);
+
+		if (res < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (res <= 0 || (fds[1].revents & POLLIN))
+		{
+			break;
+		}
+
+		SafeFdPtr client = SafeFdPtr(accept4(MailSinkSocket, nullptr, nullptr, SOCK_CLOEXEC));
+
+		if (client)
+		{
+			JoinMailSinkClients(false);
+
+			auto done = std::make_shared<std::atomic<bool>>(false);
+
+			MailSinkClients.emplace_back(std::thread([client, done]()
+				{
+					ServeMailSinkClient(client);
+
+					*done = true;
+				}), done);
+		}
+	}
+
+	JoinMailSinkClients(true);
+}
+
+bool StartMailSink(std::uint16_t port, const MailSinkOptions& options, Utf8String* certificate)
+{
+	MailSinkConfig = options;
+	MailSinkTls = SSL_CTX_new(TLS_server_method());
+
+	if (!MailSinkTls || !CreateMailSinkCertificate(MailSinkTls, certificate))
+	{
+		StopMailSink();
+		return false;
+	}
+
+	sockaddr_in addr = { 0 };
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	MailSinkSocket = SafeFdPtr(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+	MailSinkStop = SafeFdPtr(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+
+	if (!MailSinkSocket || !MailSinkStop)
+	{
+		StopMailSink();
+		return false;
+	}
+
+	int reuse = 1;
+	setsockopt(MailSinkSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	if (::bind(MailSinkSocket, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(MailSinkSocket, 16) != 0)
+	{
+		StopMailSink();
+		return false;
+	}
+
+	MailSinkThread = std::thread(ProcessMailSink);
+
+	return true;
+}
+
+// runs after the mails in flight finished, the exit event does not stop it
+void StopMailSink()
+{
+	if (MailSinkThread.joinable())
+	{
+		std::uint64_t value = 1;
+		write(MailSinkStop, &value, sizeof(value));
+
+		MailSinkThread.join();
+	}
+
+	MailSinkSocket = SafeFdPtr(-1);
+	MailSinkStop = SafeFdPtr(-1);
+
+	if (MailSinkTls)
+	{
+		SSL_CTX_free(MailSinkTls);
+		MailSinkTls = nullptr;
+	}
+}
+
+void HandleTimer()
+{
+	std::vector<PlatformString> ports;
+
+	if (HotplugThread.joinable())
+	{
+		// retries devices that failed, without touching sysfs
+		const std::lock_guard<std::mutex> lock(HotplugLock);
+
+		ports.assign(HotplugPorts.begin(), HotplugPorts.end());
+	}
+	else
+	{
+		ports = GetPorts(ModemVendor, ModemProduct);
+	}
+
+	for (auto it : ports)
+	{
+		EnsureCommPort(it);
+	}
+}
+
+speed_t ToLinkSpeed(std::uint32_t baud)
+{
+	switch (baud)
+	{
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+	case 230400: return B230400;
+	case 460800: return B460800;
+	case 921600: return B921600;
+	default: return B0;
+	}
+}
+
+class PlatformSerialLinux :public PlatformSerial
+{
+private:
+	SafeFdPtr mCom;
+private:
+	bool WaitReadLoop()
+	{
+		pollfd fds[] = { { mCom, POLLIN, 0 }, { ExitEvent, POLLIN, 0 } };
+
+		auto deadline = std::chrono::steady_clock::now() + 15s;
+
+		while (true)
+		{
+			auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+
+			if (remaining < 0)
+			{
+				remaining = 0;
+			}
+
+			int res = poll(fds, 2, (int)remaining);
+
+			if (res < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			if (res <= 0 || (fds[1].revents & POLLIN))
+			{
+				return false;
+			}
+
+			if (!(fds[0].revents & POLLIN))
+			{
+				// POLLERR, POLLHUP or POLLNVAL, device is gone
+				return false;
+			}
+
+			std::uint32_t size;
+			auto buffer = PrepareRead(&size);
+
+			int num = read(mCom, buffer, size);
+
+			if (num > 0)
+			{
+				CommitRead(num);
+				return true;
+			}
+			else if (num < 0 && (errno == EAGAIN || errno == EINTR))
+			{
+				continue;
+			}
+
+			return false;
+		}
+	}
+public:
+	PlatformSerialLinux(const SafeFdPtr& com) :PlatformSerial()
+	{
+		mCom = com;
+	}
+
+	int GetHandle() const
+	{
+		return mCom;
+	}
+
+	// reads whatever is pending without waiting, only after the port was reported readable
+	bool ReadAvailable()
+	{
+		std::uint32_t size;
+		auto buffer = PrepareRead(&size);
+
+		int num = read(mCom, buffer, size);
+
+		if (num > 0)
+		{
+			CommitRead(num);
+			return true;
+		}
+
+		// nothing to read from a readable port, device is gone
+		return num < 0 && (errno == EAGAIN || errno == EINTR);
+	}
+
+	bool WriteLine(const Utf8String& cmd)
+	{
+		auto str = cmd;
+		str.append("\n");
+
+		auto sz = str.size() * sizeof(Utf8Char);
+
+		return write(mCom, str.c_str(), sz) == (ssize_t)sz;
+	}
+
+	bool SupportsLinkSpeed(std::uint32_t baud)
+	{
+		return ToLinkSpeed(baud) != B0;
+	}
+
+	bool SetLinkSpeed(std::uint32_t baud, bool flowControl)
+	{
+		auto speed = ToLinkSpeed(baud);
+
+		termios tty;
+		if (speed == B0 || tcgetattr(mCom, &tty) != 0)
+		{
+			return false;
+		}
+
+		cfsetispeed(&tty, speed);
+		cfsetospeed(&tty, speed);
+
+		if (flowControl)
+		{
+			tty.c_cflag |= CRTSCTS;
+		}
+		else
+		{
+			tty.c_cflag &= ~CRTSCTS;
+		}
+
+		// lets the last command leave at the old rate
+		if (tcsetattr(mCom, TCSADRAIN, &tty) != 0)
+		{
+			return false;
+		}
+
+		// whatever arrived while switching is garbage
+		tcflush(mCom, TCIFLUSH);
+
+		return true;
+	}
+
+	bool ReadLine(std::string_view* line)
+	{
+		while (!WaitExitOrTimeout(0ms))
+		{
+			if (CanReadLine(line))
+			{
+				return true;
+			}
+
+			if (!WaitReadLoop())
+			{
+				return false;
+			}
+		}
+
+		return false;
+	}
+};
+
+std::shared_ptr<PlatformSerialLinux> OpenCommDevice(const PlatformString& port)
+{
+	SafeFdPtr com = SafeFdPtr(open(PlatformStringToUtf8(port).c_str(), O_RDWR));
+
+	if (com)
+	{
+		termios tty = { 0 };
+
+		tty.c_cflag = CS8 | CREAD | CLOCAL;
+		tty.c_iflag = IGNPAR | IUTF8;
+		tty.c_cc[VTIME] = 0; // waiting is done with poll()
+		tty.c_cc[VMIN] = 0;
+
+		cfsetispeed(&tty, B9600);
+		cfsetospeed(&tty, B9600);
+
+		if (tcsetattr(com, TCSANOW, &tty) == 0)
+		{
+			usleep(10000);
+
+			tcflush(com, TCIOFLUSH);
+
+			return std::make_shared<PlatformSerialLinux>(com);
+		}
+	}
+
+	return std::shared_ptr<PlatformSerialLinux>();
+}
+
+bool GetCommDevice(const std::filesystem::path& root, const PlatformString& port, SIM800C* sim)
+{
+	auto serial = OpenCommDevice(port);
+
+	if (serial)
+	{
+		*sim = SIM800C(root, port, serial);
+
+		return true;
+	}
+
+	return false;
+}
+
+class PlatformMappedFileLinux :public PlatformMappedFile
+{
+private:
+	SafeFdPtr mFile;
+	byte* mData;
+	size_t mSize;
+public:
+	PlatformMappedFileLinux(const SafeFdPtr& file, byte* data, size_t size) :PlatformMappedFile()
+	{
+		mFile = file;
+		mData = data;
+		mSize = size;
+	}
+
+	~PlatformMappedFileLinux()
+	{
+		munmap(mData, mSize);
+	}
+
+	byte* GetData()
+	{
+		return mData;
+	}
+
+	size_t GetSize() const
+	{
+		return mSize;
+	}
+
+	bool Flush(size_t offset, size_t size)
+	{
+		// msync wants a page aligned start
+		size_t page = (size_t)sysconf(_SC_PAGESIZE);
+		size_t start = offset / page * page;
+
+		return msync(mData + start, offset + size - start, MS_SYNC) == 0;
+	}
+};
+
+SafeFdPtr OpenLogFile(const std::filesystem::path& path)
+{
+	return SafeFdPtr(open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH));
+}
+
+std::shared_ptr<PlatformMappedFile> OpenMappedFile(const std::filesystem::path& path, size_t size)
+{
+	SafeFdPtr file = SafeFdPtr(open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600));
+
+	struct stat st;
+
+	if (!file || fstat(file, &st) != 0)
+	{
+		return std::shared_ptr<PlatformMappedFile>();
+	}
+
+	if ((size_t)st.st_size < size)
+	{
+		// reserve the blocks now, a full disk would otherwise fault on a later write into the mapping
+		if (posix_fallocate(file, 0, size) != 0 || fsync(file) != 0)
+		{
+			return std::shared_ptr<PlatformMappedFile>();
+		}
+
+		// the directory entry has to survive a power cut as well
+		SafeFdPtr dir = SafeFdPtr(open(path.parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+
+		if (!dir || fsync(dir) != 0)
+		{
+			return std::shared_ptr<PlatformMappedFile>();
+		}
+	}
+	else
+	{
+		size = (size_t)st.st_size;
+	}
+
+	auto data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+
+	if (data == MAP_FAILED)
+	{
+		return std::shared_ptr<PlatformMappedFile>();
+	}
+
+	return std::make_shared<PlatformMappedFileLinux>(file, (byte*)data, size);
+}
+
+class ModemReactor
+{
+private:
+	struct Modem
+	{
+		std::shared_ptr<PlatformSerialLinux> Serial;
+		SIM800C Sim;
+	};
+
+	SafeFdPtr mEpoll;
+	SafeFdPtr mWake;
+	std::thread mThread;
+	std::mutex mPendingLock;
+	std::vector<std::shared_ptr<Modem>> mPending;
+	std::map<Modem*, std::shared_ptr<Modem>> mModems;
+	std::atomic<size_t> mCount = 0;
+
+	void Adopt()
+	{
+		std::vector<std::shared_ptr<Modem>> pending;
+
+		{
+			const std::lock_guard<std::mutex> lock(mPendingLock);
+
+			pending.swap(mPending);
+		}
+
+		for (auto& modem : pending)
+		{
+			epoll_event ev = { 0 };
+			ev.events = EPOLLIN;
+			ev.data.ptr = modem.get();
+
+			if (epoll_ctl(mEpoll, EPOLL_CTL_ADD, modem->Serial->GetHandle(), &ev) != 0)
+			{
+				this->Drop(modem.get());
+				continue;
+			}
+
+			mModems[modem.get()] = modem;
+
+			PrepareCommDevice(modem->Sim);
+
+			modem->Sim.BeginInit();
+		}
+	}
+
+	void Drop(Modem* modem)
+	{
+		epoll_ctl(mEpoll, EPOLL_CTL_DEL, modem->Serial->GetHandle(), NULL);
+
+		RemoveCommPort(modem->Sim.GetPort());
+
+		mModems.erase(modem);
+
+		mCount--;
+	}
+
+	void Run()
+	{
+		std::vector<epoll_event> events(64);
+
+		bool exit = false;
+
+		while (!exit)
+		{
+			auto now = std::chrono::steady_clock::now();
+			auto timeout = now + 15s;
+
+			for (auto& it : mModems)
+			{
+				timeout = std::min(timeout, it.second->Sim.GetNextTimeout());
+			}
+
+			auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(timeout - now).count();
+
+			int num = epoll_wait(mEpoll, events.data(), (int)events.size(), wait < 0 ? 0 : (int)wait + 1);
+
+			if (num < 0 && errno != EINTR)
+			{
+				break;
+			}
+
+			for (int i = 0; i < num; i++)
+			{
+				auto ptr = events[i].data.ptr;
+
+				if (ptr == nullptr)
+				{
+					exit = true;
+				}
+				else if (ptr == this)
+				{
+					uint64_t value;
+					read(mWake, &value, sizeof(value));
+
+					this->Adopt();
+				}
+				else if (mModems.find((Modem*)ptr) != mModems.end())
+				{
+					auto modem = (Modem*)ptr;
+
+					if (!(events[i].events & (EPOLLHUP | EPOLLERR)) && (events[i].events & EPOLLIN) && modem->Serial->ReadAvailable())
+					{
+						modem->Sim.ProcessAvailable();
+					}
+					else
+					{
+						// device is gone
+						this->Drop(modem);
+					}
+				}
+			}
+
+			now = std::chrono::steady_clock::now();
+
+			std::vector<Modem*> failed;
+
+			for (auto& it : mModems)
+			{
+				it.second->Sim.CheckTimeout(now);
+
+				if (it.second->Sim.IsFailed())
+				{
+					failed.push_back(it.first);
+				}
+			}
+
+			for (auto modem : failed)
+			{
+				this->Drop(modem);
+			}
+		}
+
+		this->Adopt();
+
+		while (mModems.size() > 0)
+		{
+			this->Drop(mModems.begin()->first);
+		}
+	}
+public:
+	bool Start()
+	{
+		mEpoll = SafeFdPtr(epoll_create1(EPOLL_CLOEXEC));
+		mWake = SafeFdPtr(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+
+		if (!mEpoll || !mWake || !ExitEvent)
+		{
+			return false;
+		}
+
+		epoll_event ev = { 0 };
+		ev.events = EPOLLIN;
+		ev.data.ptr = nullptr;
+
+		if (epoll_ctl(mEpoll, EPOLL_CTL_ADD, ExitEvent, &ev) != 0)
+		{
+			return false;
+		}
+
+		ev.data.ptr = this;
+
+		if (epoll_ctl(mEpoll, EPOLL_CTL_ADD, mWake, &ev) != 0)
+		{
+			return false;
+		}
+
+		mThread = std::thread(&ModemReactor::Run, this);
+
+		return true;
+	}
+
+	void Attach(const std::filesystem::path& root, const PlatformString& port, const std::shared_ptr<PlatformSerialLinux>& serial)
+	{
+		{
+			const std::lock_guard<std::mutex> lock(mPendingLock);
+
+			mPending.push_back(std::make_shared<Modem>(Modem{ serial, SIM800C(root, port, serial) }));
+		}
+
+		mCount++;
+
+		uint64_t value = 1;
+		write(mWake, &value, sizeof(value));
+	}
+
+	size_t GetCount() const
+	{
+		return mCount;
+	}
+
+	void Join()
+	{
+		if (mThread.joinable())
+		{
+			mThread.join();
+		}
+	}
+};
+
+std::vector<std::shared_ptr<ModemReactor>> Reactors;
+
+bool StartModemReactor(size_t threads)
+{
+	for (size_t i = 0; i < threads; i++)
+	{
+		auto reactor = std::make_shared<ModemReactor>();
+
+		if (!reactor->Start())
+		{
+			break;
+		}
+
+		Reactors.push_back(reactor);
+	}
+
+	return Reactors.size() > 0;
+}
+
+bool AttachModemReactor(const std::filesystem::path& root, const PlatformString& port)
+{
+	ConsoleOut(PLATFORMSTR("Processing device at "), port);
+
+	auto serial = OpenCommDevice(port);
+
+	if (!serial)
+	{
+		return false;
+	}
+
+	auto reactor = *std::min_element(Reactors.begin(), Reactors.end(), [](const auto& a, const auto& b) { return a->GetCount() < b->GetCount(); });
+
+	reactor->Attach(root, port, serial);
+
+	return true;
+}
+
+void StopModemReactor()
+{
+	for (auto& reactor : Reactors)
+	{
+		reactor->Join();
+	}
+
+	Reactors.clear();
+}
+
+uint32_t RtlEnlargedUnsignedDivide(ULARGE_INTEGER Dividend, uint32_t Divisor, uint32_t* Remainder)
+{
+	if (Remainder)
+	{
+		*Remainder = (uint32_t)(Dividend.QuadPart % Divisor);
+	}
+
+	return (uint32_t)(Dividend.QuadPart / Divisor);
+}
+
+int MulDiv(int nNumber, int nNumerator, int nDenominator)
+{
+	LARGE_INTEGER Result;
+	int Negative;
+
+	Negative = nNumber ^ nNumerator ^ nDenominator;
+
+	if (nNumber < 0) nNumber *= -1;
+	if (nNumerator < 0) nNumerator *= -1;
+	if (nDenominator < 0) nDenominator *= -1;
+
+	Result.QuadPart = Int32x32To64(nNumber, nNumerator) + (nDenominator / 2);
+
+	if (nDenominator > Result.HighPart)
+	{
+		Result.LowPart = RtlEnlargedUnsignedDivide(*(PULARGE_INTEGER)&Result, (uint32_t)nDenominator, (uint32_t*)&Result.HighPart);
+
+		if ((int)Result.LowPart >= 0)
+		{
+			return (Negative >= 0) ? (int)Result.LowPart : -(int)Result.LowPart;
+		}
+	}
+
+	return -1;
+}
+
+void CtrlHandler(int signum)
+{
+	PLATFORMCOUT << PLATFORMSTR("Received closing event...") << std::endl;
+
+	if (ExitEvent)
+	{
+		uint64_t value = 1;
+		write(ExitEvent, &value, sizeof(value));
+	}
+
+	ExitReset.Set();
+}
+
+void ReportHandler(int signum)
+{
+	LatencyReportRequested = true;
+}
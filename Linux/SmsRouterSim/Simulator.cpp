@@ -0,0 +1,1187 @@
+// Author: Martin Wetzko
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+
+using SimClock = std::chrono::steady_clock;
+
+// SIM800C rates, 0 is autobaud
+const std::uint32_t SimLinkSpeeds[] = { 0, 1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800 };
+
+const char* SimLinkSpeedList = "+IPR: (0,1200,2400,4800,9600,19200,38400,57600,115200,230400,460800),()";
+
+// every ring repeats the caller ID, like a phone ringing for 9 seconds
+const int CallRings = 3;
+const auto CallRingInterval = 3s;
+
+// a lost network comes back after searching for a while
+const auto NetworkSearchTime = 2s;
+
+// the network stops delivering while the SIM card is full and retries once there is room
+size_t StorageSlots = 50;
+
+// 153 septets of text per part of a concatenated message
+size_t MessageParts = 1;
+
+std::string LinkPrefix = "/tmp/smsrouter-sim";
+size_t ModemCount = 1;
+double SmsRate = 0;
+double CallRate = 0;
+double NetworkLossRate = 0;
+std::chrono::seconds Duration{ 0 };
+std::chrono::seconds ReportInterval{ 5 };
+std::string ScriptPath;
+
+volatile std::sig_atomic_t Stopping = 0;
+
+std::mt19937_64 Random;
+
+enum class SimEvent
+{
+	Sms,
+	Call,
+	NetworkLoss
+};
+
+struct ScriptEntry
+{
+	SimClock::duration At;
+
+	// -1 for every modem
+	int Modem;
+	SimEvent Event;
+	int Count;
+};
+
+struct StoredSms
+{
+	std::string PDU;
+	bool Read = false;
+	SimClock::time_point Injected;
+};
+
+struct SimStats
+{
+	std::uint64_t Injected = 0;
+	std::uint64_t Listed = 0;
+	std::uint64_t Deleted = 0;
+	std::uint64_t Calls = 0;
+	std::uint64_t Commands = 0;
+	std::uint64_t Ignored = 0;
+
+	// from storing a message until the router deleted it, in microseconds
+	std::vector<std::uint32_t> Latencies;
+};
+
+SimStats Stats;
+
+std::uint32_t ToBaud(speed_t speed)
+{
+	switch (speed)
+	{
+	case B1200: return 1200;
+	case B2400: return 2400;
+	case B4800: return 4800;
+	case B9600: return 9600;
+	case B19200: return 19200;
+	case B38400: return 38400;
+	case B57600: return 57600;
+	case B115200: return 115200;
+	case B230400: return 230400;
+	case B460800: return 460800;
+	default: return 0;
+	}
+}
+
+// 10 bits per byte with start and stop bit
+SimClock::duration GetTransferTime(size_t bytes, std::uint32_t baud)
+{
+	return std::chrono::duration_cast<SimClock::duration>(std::chrono::duration<double>(bytes * 10.0 / baud));
+}
+
+void AppendHexByte(std::string& out, std::uint8_t value)
+{
+	static constexpr char Digits[] = "0123456789ABCDEF";
+
+	out.push_back(Digits[value >> 4]);
+	out.push_back(Digits[value & 0xF]);
+}
+
+// digits swapped in pairs, an odd count is padded with F
+void AppendSemiOctets(std::string& out, std::string_view digits)
+{
+	for (size_t i = 0; i < digits.size(); i += 2)
+	{
+		out.push_back(i + 1 < digits.size() ? digits[i + 1] : 'F');
+		out.push_back(digits[i]);
+	}
+}
+
+// SMS-DELIVER in GSM 7 bit, the text only uses characters with the same code in ASCII
+std::string EncodeSmsDeliver(const std::string& sender, const std::string& text, int reference, int parts, int part)
+{
+	std::string pdu = "07911326040000F0";
+
+	bool header = parts > 1;
+
+	AppendHexByte(pdu, header ? 0x44 : 0x04);
+	AppendHexByte(pdu, (std::uint8_t)sender.size());
+	AppendHexByte(pdu, 0x91);
+	AppendSemiOctets(pdu, sender);
+	pdu.append("0000");
+
+	// service centre time stamp in UTC
+	std::time_t now = std::time(nullptr);
+	std::tm tm = { 0 };
+	gmtime_r(&now, &tm);
+
+	char stamp[64];
+	std::snprintf(stamp, sizeof(stamp), "%02d%02d%02d%02d%02d%02d00", tm.tm_year % 100, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+	AppendSemiOctets(pdu, stamp);
+
+	// the concatenation header takes 6 bytes and one fill bit, 7 septets
+	std::vector<std::uint8_t> data;
+	size_t bit = 0;
+
+	if (header)
+	{
+		data = { 0x05, 0x00, 0x03, (std::uint8_t)reference, (std::uint8_t)parts, (std::uint8_t)part };
+		bit = 49;
+	}
+
+	for (auto c : text)
+	{
+		for (int i = 0; i < 7; i++, bit++)
+		{
+			if (bit / 8 >= data.size())
+			{
+				data.push_back(0);
+			}
+
+			if (c & (1 << i))
+			{
+				data[bit / 8] |= (std::uint8_t)(1 << (bit % 8));
+			}
+		}
+	}
+
+	AppendHexByte(pdu, (std::uint8_t)((bit + 6) / 7));
+
+	for (auto value : data)
+	{
+		AppendHexByte(pdu, value);
+	}
+
+	return pdu;
+}
+
+std::string GetRandomNumber(std::string_view prefix)
+{
+	// a small pool, so callers repeat like in real storms
+	return std::string(prefix) + std::to_string(1000000 + Random() % 1000);
+}
+
+SimClock::duration GetPoissonDelay(double rate)
+{
+	std::exponential_distribution<double> next(rate);
+
+	return std::chrono::duration_cast<SimClock::duration>(std::chrono::duration<double>(next(Random)));
+}
+
+class SimModem
+{
+private:
+	int mIndex;
+	int mMaster = -1;
+	int mSlave = -1;
+	std::string mLink;
+
+	std::string mInput;
+	std::string mOutput;
+
+	struct PendingCommand
+	{
+		SimClock::time_point Ready;
+		std::string Line;
+	};
+
+	std::vector<PendingCommand> mCommands;
+	SimClock::time_point mReceiveFree;
+	SimClock::time_point mSendFree;
+
+	bool mEcho = true;
+	std::uint32_t mLinkSpeed = 0;
+	std::uint32_t mNextLinkSpeed = 0;
+
+	// what the router queries and writes with AT&W, unset like a fresh modem
+	std::map<std::string, std::string> mProfile = { { "+CMGF", "1" }, { "+CRC", "0" }, { "+CREG", "0" }, { "+CLIP", "0" }, { "+CNMI", "0" }, { "+IFC", "0,0" } };
+	std::map<std::string, std::string> mSavedProfile = mProfile;
+
+	std::map<int, StoredSms> mStorage;
+	size_t mWaitingSms = 0;
+	std::uint64_t mNextSms = 1;
+
+	bool mRegistered = true;
+	SimClock::time_point mRegisterAt;
+
+	std::string mCaller;
+	int mRingsLeft = 0;
+	SimClock::time_point mNextRing;
+
+	SimClock::time_point mNextRandomSms = SimClock::time_point::max();
+	SimClock::time_point mNextRandomCall = SimClock::time_point::max();
+	SimClock::time_point mNextRandomLoss = SimClock::time_point::max();
+
+	std::uint32_t GetHostLinkSpeed() const
+	{
+		termios tty;
+
+		if (tcgetattr(mSlave, &tty) != 0)
+		{
+			return 0;
+		}
+
+		return ToBaud(cfgetospeed(&tty));
+	}
+
+	// the host at another rate sees garbage, neither side understands the other
+	bool IsLinkMatching() const
+	{
+		return mLinkSpeed == 0 || mLinkSpeed == this->GetHostLinkSpeed();
+	}
+
+	std::uint32_t GetPacingSpeed() const
+	{
+		auto speed = mLinkSpeed != 0 ? mLinkSpeed : this->GetHostLinkSpeed();
+
+		return speed != 0 ? speed : 9600;
+	}
+
+	void Send(std::string_view line)
+	{
+		if (!this->IsLinkMatching())
+		{
+			return;
+		}
+
+		mOutput.append("\r\n");
+		mOutput.append(line);
+		mOutput.append("\r\n");
+	}
+
+	std::string GetSetting(const std::string& code) const
+	{
+		auto it = mProfile.find(code);
+
+		return it != mProfile.end() ? it->second : "";
+	}
+
+	bool StoreSms(const std::string& pdu)
+	{
+		if (mStorage.size() >= StorageSlots)
+		{
+			return false;
+		}
+
+		int index = 1;
+
+		while (mStorage.contains(index))
+		{
+			index++;
+		}
+
+		mStorage[index] = { pdu, false, SimClock::now() };
+
+		Stats.Injected++;
+
+		if (this->GetSetting("+CNMI").starts_with("2") || this->GetSetting("+CNMI").starts_with("1"))
+		{
+			this->Send("+CMTI: \"SM\"," + std::to_string(index));
+		}
+
+		return true;
+	}
+
+	void DeliverWaitingSms()
+	{
+		while (mWaitingSms > 0)
+		{
+			auto sender = GetRandomNumber("49155");
+			auto reference = (int)(mNextSms % 256);
+			auto text = "Simulated message " + std::to_string(mNextSms++) + " from modem " + std::to_string(mIndex);
+
+			if (mStorage.size() + MessageParts > StorageSlots)
+			{
+				return;
+			}
+
+			for (size_t part = 1; part <= MessageParts; part++)
+			{
+				auto body = text;
+
+				if (MessageParts > 1)
+				{
+					// every part is filled up to its 153 septets
+					body.append(" part " + std::to_string(part));
+					body.resize(153, '.');
+				}
+
+				this->StoreSms(EncodeSmsDeliver(sender, body, reference, (int)MessageParts, (int)part));
+			}
+
+			mWaitingSms--;
+		}
+	}
+
+	void DeleteSms(std::map<int, StoredSms>::iterator it)
+	{
+		auto latency = std::chrono::duration_cast<std::chrono::microseconds>(SimClock::now() - it->second.Injected).count();
+
+		Stats.Latencies.push_back((std::uint32_t)std::min<long long>(latency, UINT32_MAX));
+		Stats.Deleted++;
+
+		mStorage.erase(it);
+	}
+
+	bool HandleListSms(int filter)
+	{
+		if (this->GetSetting("+CMGF") != "0" || filter < 0 || filter > 4)
+		{
+			return false;
+		}
+
+		for (auto& [index, sms] : mStorage)
+		{
+			if (filter != 4 && filter != (sms.Read ? 1 : 0))
+			{
+				continue;
+			}
+
+			// length of the TPDU without the service centre in front
+			this->Send("+CMGL: " + std::to_string(index) + "," + (sms.Read ? "1" : "0") + ",\"\"," + std::to_string(sms.PDU.size() / 2 - 8) + "\r\n" + sms.PDU);
+
+			sms.Read = true;
+
+			Stats.Listed++;
+		}
+
+		return true;
+	}
+
+	bool HandleDeleteSms(int index, int flag)
+	{
+		// 1 read, 2 read and sent, 3 read, sent and unsent, 4 all, received messages are never sent or unsent
+		if (flag > 0)
+		{
+			for (auto it = mStorage.begin(); it != mStorage.end();)
+			{
+				auto next = std::next(it);
+
+				if (flag == 4 || it->second.Read)
+				{
+					this->DeleteSms(it);
+				}
+
+				it = next;
+			}
+		}
+		else
+		{
+			auto it = mStorage.find(index);
+
+			if (it != mStorage.end())
+			{
+				this->DeleteSms(it);
+			}
+		}
+
+		this->DeliverWaitingSms();
+
+		return true;
+	}
+
+	// one part of a command line without the AT, false answers ERROR
+	bool HandleCommand(const std::string& cmd)
+	{
+		if (cmd == "E0" || cmd == "E1")
+		{
+			mEcho = cmd == "E1";
+			return true;
+		}
+
+		if (cmd == "&W")
+		{
+			mSavedProfile = mProfile;
+			return true;
+		}
+
+		if (cmd == "Z")
+		{
+			mProfile = mSavedProfile;
+			return true;
+		}
+
+		if (cmd == "+CPIN?")
+		{
+			this->Send("+CPIN: READY");
+			return true;
+		}
+
+		if (cmd == "+CNUM")
+		{
+			this->Send("+CNUM: \"\",\"+4915550" + std::to_string(10000 + mIndex) + "\",145,7,4");
+			return true;
+		}
+
+		if (cmd == "+CCID")
+		{
+			this->Send("894902000" + std::to_string(1000000000 + mIndex));
+			return true;
+		}
+
+		if (cmd == "+IPR=?")
+		{
+			this->Send(SimLinkSpeedList);
+			return true;
+		}
+
+		if (cmd == "+IPR?")
+		{
+			this->Send("+IPR: " + std::to_string(mLinkSpeed));
+			return true;
+		}
+
+		if (cmd.starts_with("+IPR="))
+		{
+			auto rate = (std::uint32_t)std::strtoul(cmd.c_str() + 5, nullptr, 10);
+
+			if (std::find(std::begin(SimLinkSpeeds), std::end(SimLinkSpeeds), rate) == std::end(SimLinkSpeeds))
+			{
+				return false;
+			}
+
+			// switches once the answer left at the old rate
+			mNextLinkSpeed = rate;
+			return true;
+		}
+
+		if (cmd.starts_with("+CMGL="))
+		{
+			return this->HandleListSms(std::atoi(cmd.c_str() + 6));
+		}
+
+		if (cmd.starts_with("+CMGD="))
+		{
+			auto comma = cmd.find(',');
+
+			return this->HandleDeleteSms(std::atoi(cmd.c_str() + 6), comma != std::string::npos ? std::atoi(cmd.c_str() + comma + 1) : 0);
+		}
+
+		auto pos = cmd.find_first_of("=?");
+		auto code = cmd.substr(0, pos);
+
+		if (!mProfile.contains(code) || pos == std::string::npos)
+		{
+			return false;
+		}
+
+		if (cmd.substr(pos) == "?")
+		{
+			auto value = mProfile[code];
+
+			// the queries answer more than the router sets
+			if (code == "+CREG")
+			{
+				value.append(mRegistered ? ",1" : ",2");
+			}
+			else if (code == "+CLIP")
+			{
+				value.append(",1");
+			}
+			else if (code == "+CNMI")
+			{
+				value.append(",1,0,0,0");
+			}
+
+			this->Send(code + ": " + value);
+			return true;
+		}
+
+		if (cmd[pos] == '=' && pos + 1 < cmd.size() && cmd[pos + 1] != '?')
+		{
+			// only the first value counts, except for the flow control pair
+			auto value = cmd.substr(pos + 1);
+			mProfile[code] = code == "+IFC" ? value : value.substr(0, value.find(','));
+			return true;
+		}
+
+		return false;
+	}
+
+	void HandleLine(const std::string& line)
+	{
+		Stats.Commands++;
+
+		if (mEcho)
+		{
+			mOutput.append(line);
+			mOutput.append("\r\n");
+		}
+
+		std::string upper = line;
+		std::transform(upper.begin(), upper.end(), upper.begin(), [](char c) { return (char)std::toupper((unsigned char)c); });
+
+		if (!upper.starts_with("AT"))
+		{
+			this->Send("ERROR");
+			return;
+		}
+
+		// "AT+A?;+B=1;E0&W": extended commands end at ';', basic ones are a letter with digits
+		size_t pos = 2;
+
+		while (pos < upper.size())
+		{
+			size_t end;
+
+			if (upper[pos] == '+')
+			{
+				end = std::min(upper.find(';', pos), upper.size());
+			}
+			else
+			{
+				end = pos + (upper[pos] == '&' ? 2 : 1);
+
+				while (end < upper.size() && std::isdigit((unsigned char)upper[end]))
+				{
+					end++;
+				}
+			}
+
+			if (!this->HandleCommand(upper.substr(pos, end - pos)))
+			{
+				this->Send("ERROR");
+				return;
+			}
+
+			pos = end < upper.size() && upper[end] == ';' ? end + 1 : end;
+		}
+
+		this->Send("OK");
+	}
+
+public:
+	SimModem(int index)
+	{
+		mIndex = index;
+		mLink = LinkPrefix + std::to_string(index);
+	}
+
+	~SimModem()
+	{
+		unlink(mLink.c_str());
+
+		if (mMaster >= 0)
+		{
+			close(mMaster);
+		}
+
+		if (mSlave >= 0)
+		{
+			close(mSlave);
+		}
+	}
+
+	bool Open()
+	{
+		// raw from the start, an echoing line discipline would feed the output back before the router opens the port
+		termios tty = { 0 };
+		cfmakeraw(&tty);
+		cfsetispeed(&tty, B9600);
+		cfsetospeed(&tty, B9600);
+
+		char name[128];
+
+		if (openpty(&mMaster, &mSlave, name, &tty, nullptr) != 0)
+		{
+			return false;
+		}
+
+		fcntl(mMaster, F_SETFL, fcntl(mMaster, F_GETFL) | O_NONBLOCK);
+		fcntl(mMaster, F_SETFD, FD_CLOEXEC);
+		fcntl(mSlave, F_SETFD, FD_CLOEXEC);
+
+		unlink(mLink.c_str());
+
+		if (symlink(name, mLink.c_str()) != 0)
+		{
+			return false;
+		}
+
+		return true;
+	}
+
+	const std::string& GetLink() const
+	{
+		return mLink;
+	}
+
+	int GetHandle() const
+	{
+		return mMaster;
+	}
+
+	size_t GetStoredSms() const
+	{
+		return mStorage.size();
+	}
+
+	size_t GetWaitingSms() const
+	{
+		return mWaitingSms;
+	}
+
+	bool HasOutput() const
+	{
+		return mOutput.size() > 0;
+	}
+
+	void StartRandom(SimClock::time_point now)
+	{
+		if (SmsRate > 0)
+		{
+			mNextRandomSms = now + GetPoissonDelay(SmsRate);
+		}
+
+		if (CallRate > 0)
+		{
+			mNextRandomCall = now + GetPoissonDelay(CallRate);
+		}
+
+		if (NetworkLossRate > 0)
+		{
+			mNextRandomLoss = now + GetPoissonDelay(NetworkLossRate);
+		}
+	}
+
+	void Inject(SimEvent event, int count)
+	{
+		switch (event)
+		{
+		case SimEvent::Sms:
+			mWaitingSms += count;
+			this->DeliverWaitingSms();
+			break;
+		case SimEvent::Call:
+			// a new call replaces the ringing one
+			mCaller = "+" + GetRandomNumber("4917");
+			mRingsLeft = CallRings * count;
+			mNextRing = SimClock::now();
+			Stats.Calls++;
+			break;
+		case SimEvent::NetworkLoss:
+			if (mRegistered)
+			{
+				mRegistered = false;
+				mRegisterAt = SimClock::now() + NetworkSearchTime;
+
+				if (this->GetSetting("+CREG") == "1")
+				{
+					this->Send("+CREG: 2");
+				}
+			}
+			break;
+		}
+	}
+
+	// reads what the router wrote, a command is handled once it would have arrived at the current rate
+	bool Read(SimClock::time_point now)
+	{
+		char buffer[1024];
+
+		while (true)
+		{
+			auto num = read(mMaster, buffer, sizeof(buffer));
+
+			if (num < 0 && errno == EIO)
+			{
+				// nobody has the port open, the slave end is still kept open here
+				return true;
+			}
+
+			if (num <= 0)
+			{
+				return num == 0 || errno == EAGAIN || errno == EINTR;
+			}
+
+			if (!this->IsLinkMatching())
+			{
+				Stats.Ignored += num;
+				continue;
+			}
+
+			auto speed = this->GetPacingSpeed();
+
+			for (ssize_t i = 0; i < num; i++)
+			{
+				if (buffer[i] != '\r' && buffer[i] != '\n')
+				{
+					mInput.push_back(buffer[i]);
+					continue;
+				}
+
+				if (mInput.empty())
+				{
+					continue;
+				}
+
+				mReceiveFree = std::max(mReceiveFree, now) + GetTransferTime(mInput.size() + 1, speed);
+				mCommands.push_back({ mReceiveFree, mInput });
+				mInput.clear();
+			}
+		}
+	}
+
+	// handles the due commands and events and sends what the line allows, returns when there is more to do
+	SimClock::time_point Process(SimClock::time_point now)
+	{
+		auto next = SimClock::time_point::max();
+
+		// a command waits for the answer to the previous one like on the real modem
+		while (mCommands.size() > 0 && mCommands.front().Ready <= now && mOutput.empty() && mNextLinkSpeed == 0)
+		{
+			auto line = std::move(mCommands.front().Line);
+			mCommands.erase(mCommands.begin());
+
+			this->HandleLine(line);
+		}
+
+		if (mCommands.size() > 0)
+		{
+			next = std::min(next, std::max(mCommands.front().Ready, now + 1ms));
+		}
+
+		if (mNextRandomSms <= now)
+		{
+			this->Inject(SimEvent::Sms, 1);
+			mNextRandomSms = now + GetPoissonDelay(SmsRate);
+		}
+
+		if (mNextRandomCall <= now)
+		{
+			this->Inject(SimEvent::Call, 1);
+			mNextRandomCall = now + GetPoissonDelay(CallRate);
+		}
+
+		if (mNextRandomLoss <= now)
+		{
+			this->Inject(SimEvent::NetworkLoss, 1);
+			mNextRandomLoss = now + GetPoissonDelay(NetworkLossRate);
+		}
+
+		next = std::min({ next, mNextRandomSms, mNextRandomCall, mNextRandomLoss });
+
+		if (!mRegistered)
+		{
+			if (mRegisterAt <= now)
+			{
+				mRegistered = true;
+
+				if (this->GetSetting("+CREG") == "1")
+				{
+					this->Send("+CREG: 1");
+				}
+			}
+			else
+			{
+				next = std::min(next, mRegisterAt);
+			}
+		}
+
+		if (mRingsLeft > 0)
+		{
+			if (mNextRing <= now)
+			{
+				this->Send(this->GetSetting("+CRC") == "1" ? "+CRING: VOICE" : "RING");
+
+				if (this->GetSetting("+CLIP") == "1")
+				{
+					this->Send("+CLIP: \"" + mCaller + "\",145,\"\",0,\"\",0");
+				}
+
+				mRingsLeft--;
+				mNextRing = now + CallRingInterval;
+			}
+
+			if (mRingsLeft > 0)
+			{
+				next = std::min(next, mNextRing);
+			}
+		}
+
+		if (mOutput.size() > 0)
+		{
+			if (mSendFree <= now)
+			{
+				// 5ms worth of bytes at a time, the line is busy for exactly as long as they take
+				auto speed = this->GetPacingSpeed();
+				auto chunk = std::min(mOutput.size(), std::max<size_t>(speed / 10 / 200, 1));
+				auto num = write(mMaster, mOutput.data(), chunk);
+
+				if (num > 0)
+				{
+					mOutput.erase(0, num);
+					mSendFree = std::max(mSendFree, now - 5ms) + GetTransferTime(num, speed);
+				}
+				else
+				{
+					// the router does not read, the pty buffer is full
+					mSendFree = now + 5ms;
+				}
+			}
+
+			next = std::min(next, mSendFree);
+		}
+		else if (mNextLinkSpeed != 0)
+		{
+			mLinkSpeed = mNextLinkSpeed;
+			mNextLinkSpeed = 0;
+
+			next = now;
+		}
+
+		return next;
+	}
+};
+
+bool LoadScript(const std::string& path, std::vector<ScriptEntry>& script)
+{
+	// "<seconds> <modem|*> <sms|call|creg> [count]" per line, # starts a comment
+	std::ifstream file(path);
+
+	if (!file)
+	{
+		return false;
+	}
+
+	std::string line;
+
+	while (std::getline(file, line))
+	{
+		line = line.substr(0, line.find('#'));
+
+		std::istringstream strm(line);
+
+		double at;
+		std::string modem;
+		std::string event;
+		int count = 1;
+
+		if (!(strm >> at >> modem >> event))
+		{
+			continue;
+		}
+
+		strm >> count;
+
+		ScriptEntry entry;
+		entry.At = std::chrono::duration_cast<SimClock::duration>(std::chrono::duration<double>(at));
+		entry.Modem = modem == "*" ? -1 : std::atoi(modem.c_str());
+		entry.Count = std::max(count, 1);
+
+		if (event == "sms")
+		{
+			entry.Event = SimEvent::Sms;
+		}
+		else if (event == "call")
+		{
+			entry.Event = SimEvent::Call;
+		}
+		else if (event == "creg")
+		{
+			entry.Event = SimEvent::NetworkLoss;
+		}
+		else
+		{
+			std::fprintf(stderr, "Unknown event in script: %s\n", line.c_str());
+			return false;
+		}
+
+		script.push_back(entry);
+	}
+
+	std::stable_sort(script.begin(), script.end(), [](const ScriptEntry& a, const ScriptEntry& b) { return a.At < b.At; });
+
+	return true;
+}
+
+double GetLatencyQuantile(std::vector<std::uint32_t>& latencies, double quantile)
+{
+	if (latencies.empty())
+	{
+		return 0;
+	}
+
+	auto rank = std::min((size_t)(quantile * latencies.size()), latencies.size() - 1);
+	std::nth_element(latencies.begin(), latencies.begin() + rank, latencies.end());
+
+	return latencies[rank] / 1000.0;
+}
+
+void PrintReport(const std::vector<std::unique_ptr<SimModem>>& modems, const SimStats& last, double seconds)
+{
+	size_t stored = 0;
+	size_t waiting = 0;
+
+	for (auto& modem : modems)
+	{
+		stored += modem->GetStoredSms();
+		waiting += modem->GetWaitingSms();
+	}
+
+	std::printf("%8.1f/s injected %8.1f/s listed %8.1f/s deleted, %zu on SIM cards, %zu waiting for room, %llu calls\n",
+		(Stats.Injected - last.Injected) / seconds, (Stats.Listed - last.Listed) / seconds, (Stats.Deleted - last.Deleted) / seconds, stored, waiting, (unsigned long long)Stats.Calls);
+	std::fflush(stdout);
+}
+
+void PrintSummary(double seconds)
+{
+	std::printf("\n%llu injected, %llu listed, %llu deleted in %.1fs, %.1f messages/s\n",
+		(unsigned long long)Stats.Injected, (unsigned long long)Stats.Listed, (unsigned long long)Stats.Deleted, seconds, seconds > 0 ? Stats.Deleted / seconds : 0.0);
+	std::printf("%llu commands, %llu calls, %llu bytes ignored at a wrong link speed\n",
+		(unsigned long long)Stats.Commands, (unsigned long long)Stats.Calls, (unsigned long long)Stats.Ignored);
+
+	auto& latencies = Stats.Latencies;
+
+	if (latencies.size() > 0)
+	{
+		std::printf("stored until deleted: p50 %.1fms p90 %.1fms p99 %.1fms max %.1fms\n",
+			GetLatencyQuantile(latencies, 0.5), GetLatencyQuantile(latencies, 0.9), GetLatencyQuantile(latencies, 0.99), *std::max_element(latencies.begin(), latencies.end()) / 1000.0);
+	}
+}
+
+void StopHandler(int)
+{
+	Stopping = 1;
+}
+
+void PrintUsage(const char* exe)
+{
+	std::printf("Usage: %s [-modems <count>] [-link <path prefix>] [-smsrate <per second and modem>] [-callrate <per second and modem>] [-cregrate <per second and modem>]"
+		" [-parts <count>] [-storage <slots>] [-script <path>] [-duration <seconds>] [-report <seconds>] [-seed <number>]\n", exe);
+}
+
+int main(int argc, char** argv)
+{
+	std::uint64_t seed = std::random_device()();
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string_view arg = argv[i];
+
+		if (i + 1 >= argc)
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+
+		if (arg == "-modems")
+		{
+			ModemCount = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "-link")
+		{
+			LinkPrefix = argv[++i];
+		}
+		else if (arg == "-smsrate")
+		{
+			SmsRate = std::atof(argv[++i]);
+		}
+		else if (arg == "-callrate")
+		{
+			CallRate = std::atof(argv[++i]);
+		}
+		else if (arg == "-cregrate")
+		{
+			NetworkLossRate = std::atof(argv[++i]);
+		}
+		else if (arg == "-parts")
+		{
+			MessageParts = std::clamp(std::atoi(argv[++i]), 1, 255);
+		}
+		else if (arg == "-storage")
+		{
+			StorageSlots = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "-script")
+		{
+			ScriptPath = argv[++i];
+		}
+		else if (arg == "-duration")
+		{
+			Duration = std::chrono::seconds(std::atoi(argv[++i]));
+		}
+		else if (arg == "-report")
+		{
+			ReportInterval = std::chrono::seconds(std::max(std::atoi(argv[++i]), 1));
+		}
+		else if (arg == "-seed")
+		{
+			seed = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	Random.seed(seed);
+
+	std::vector<ScriptEntry> script;
+
+	if (ScriptPath.size() > 0 && !LoadScript(ScriptPath, script))
+	{
+		std::fprintf(stderr, "Unable to read the script %s\n", ScriptPath.c_str());
+		return 1;
+	}
+
+	std::vector<std::unique_ptr<SimModem>> modems;
+	std::string ports;
+
+	for (size_t i = 0; i < ModemCount; i++)
+	{
+		auto modem = std::make_unique<SimModem>((int)i);
+
+		if (!modem->Open())
+		{
+			std::fprintf(stderr, "Unable to create the pty for %s\n", modem->GetLink().c_str());
+			return 1;
+		}
+
+		ports.append(ports.size() > 0 ? "," : "").append(modem->GetLink());
+		modems.push_back(std::move(modem));
+	}
+
+	std::printf("%zu modems ready, start the router with -ports %s\n", modems.size(), ports.c_str());
+	std::fflush(stdout);
+
+	struct sigaction action = { 0 };
+	action.sa_handler = StopHandler;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+
+	auto start = SimClock::now();
+	auto end = Duration.count() > 0 ? start + Duration : SimClock::time_point::max();
+	auto nextReport = start + ReportInterval;
+	auto lastReport = start;
+	auto last = Stats;
+	size_t nextScript = 0;
+
+	for (auto& modem : modems)
+	{
+		modem->StartRandom(start);
+	}
+
+	std::vector<pollfd> fds(modems.size());
+
+	for (size_t i = 0; i < modems.size(); i++)
+	{
+		fds[i] = { modems[i]->GetHandle(), POLLIN, 0 };
+	}
+
+	while (!Stopping)
+	{
+		auto now = SimClock::now();
+
+		if (now >= end)
+		{
+			break;
+		}
+
+		while (nextScript < script.size() && start + script[nextScript].At <= now)
+		{
+			auto& entry = script[nextScript++];
+
+			for (size_t i = 0; i < modems.size(); i++)
+			{
+				if (entry.Modem < 0 || (size_t)entry.Modem == i)
+				{
+					modems[i]->Inject(entry.Event, entry.Count);
+				}
+			}
+		}
+
+		auto next = std::min(end, nextReport);
+
+		if (nextScript < script.size())
+		{
+			next = std::min(next, start + script[nextScript].At);
+		}
+
+		for (auto& modem : modems)
+		{
+			next = std::min(next, modem->Process(now));
+		}
+
+		if (nextReport <= now)
+		{
+			PrintReport(modems, last, std::chrono::duration<double>(now - lastReport).count());
+
+			last = Stats;
+			last.Latencies.clear();
+			lastReport = now;
+			nextReport = now + ReportInterval;
+			continue;
+		}
+
+		auto wait = std::chrono::ceil<std::chrono::milliseconds>(next - now).count();
+
+		if (poll(fds.data(), fds.size(), (int)std::clamp<long long>(wait, 0, 1000)) < 0 && errno != EINTR)
+		{
+			break;
+		}
+
+		now = SimClock::now();
+
+		for (size_t i = 0; i < fds.size(); i++)
+		{
+			// a closed slave end keeps reporting hang up, it is looked at again with the next wakeup
+			if ((fds[i].revents & POLLIN) && !modems[i]->Read(now))
+			{
+				std::fprintf(stderr, "Reading from %s failed\n", modems[i]->GetLink().c_str());
+				Stopping = 1;
+			}
+		}
+	}
+
+	PrintSummary(std::chrono::duration<double>(SimClock::now() - start).count());
+
+	return 0;
+}
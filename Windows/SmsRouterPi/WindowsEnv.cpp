@@ -8,6 +8,8 @@
 // SOFTWARE.
 
 #include "Shared.h"
+#include "Metrics.h"
+#include "MailSink.h"
 #include "SIM800C.h"
 #include <Windows.h>
 #include <SetupAPI.h>
@@ -15,12 +17,20 @@
 
 SafeFdPtr ExclusiveProcess;
 
+// signaled once on exit, serial waits are cancelled with it
+SafeHANDLE ExitHandle;
+
 BOOL WINAPI CtrlHandler(DWORD);
 
 int wmain(int argc, wchar_t* argv[])
 {
 	std::setlocale(LC_ALL, "iv.utf8");
 
+	ExitHandle = SafeHANDLE(CreateEventW(NULL, TRUE, FALSE, NULL));
+
+	// log lines are written as utf-8
+	SetConsoleOutputCP(CP_UTF8);
+
 	SetConsoleCtrlHandler(CtrlHandler, TRUE);
 
 	std::vector<PlatformString> vec;
@@ -82,15 +92,15 @@ void CheckHardwareID(DWORD vid, DWORD pid)
 	delete[] str;
 }
 
-void HandleTimer()
+// windows keeps the COM number of a device across replugs and reboots
+PlatformString GetPortIdentity(const PlatformString& port)
 {
-	CheckHardwareID(0x1A86, 0x7523);
+	return std::filesystem::path(port).filename().wstring();
 }
 
-PlatformString UCS2ToPlatformString(const std::u16string& str)
+void HandleTimer()
 {
-	// on windows wstring is u16string
-	return PlatformString(str.begin(), str.end());
+	CheckHardwareID(0x1A86, 0x7523);
 }
 
 class PlatformSerialWindows :public PlatformSerial
@@ -100,29 +110,21 @@ private:
 	SafeHANDLE mWriteReset;
 	SafeHANDLE mReadReset;
 private:
-	bool WaitCancelOverlapped(HANDLE overlapped)
+	bool WaitCancelOverlapped(OVERLAPPED* op)
 	{
-		for (int i = 0; i < 150; i++)
-		{
-			auto res = WaitForSingleObject(overlapped, 100);
+		HANDLE handles[] = { op->hEvent, ExitHandle };
 
-			if (res == WAIT_OBJECT_0)
-			{
-				return true;
-			}
-			else if (res == WAIT_TIMEOUT)
-			{
-				if (WaitExitOrTimeout(100ms))
-				{
-					break;
-				}
-			}
-			else
-			{
-				break;
-			}
+		if (WaitForMultipleObjects(ExitHandle ? 2 : 1, handles, FALSE, 15000) == WAIT_OBJECT_0)
+		{
+			return true;
 		}
 
+		// timeout or exit, the request has to be finished before op goes away
+		CancelIoEx(mCom, op);
+
+		DWORD transferred;
+		GetOverlappedResult(mCom, op, &transferred, TRUE);
+
 		return false;
 	}
 public:
@@ -148,7 +150,7 @@ public:
 				return false;
 			}
 
-			if (!this->WaitCancelOverlapped(mWriteReset))
+			if (!this->WaitCancelOverlapped(&op))
 			{
 				return false;
 			}
@@ -162,28 +164,78 @@ public:
 		return true;
 	}
 
-	bool ReadLine(Utf8String* line)
+	bool SupportsLinkSpeed(std::uint32_t baud)
+	{
+		COMMPROP prop = { 0 };
+		if (!GetCommProperties(mCom, &prop))
+		{
+			return false;
+		}
+
+		if (prop.dwMaxBaud == BAUD_USER)
+		{
+			return true;
+		}
+
+		switch (baud)
+		{
+		case 9600: return (prop.dwSettableBaud & BAUD_9600) != 0;
+		case 19200: return (prop.dwSettableBaud & BAUD_19200) != 0;
+		case 38400: return (prop.dwSettableBaud & BAUD_38400) != 0;
+		case 57600: return (prop.dwSettableBaud & BAUD_57600) != 0;
+		case 115200: return (prop.dwSettableBaud & BAUD_115200) != 0;
+		default: return false;
+		}
+	}
+
+	bool SetLinkSpeed(std::uint32_t baud, bool flowControl)
+	{
+		DCB dcb = { 0 };
+		dcb.DCBlength = sizeof(DCB);
+
+		if (!GetCommState(mCom, &dcb))
+		{
+			return false;
+		}
+
+		dcb.BaudRate = baud;
+		dcb.fOutxCtsFlow = flowControl;
+		dcb.fRtsControl = flowControl ? RTS_CONTROL_HANDSHAKE : RTS_CONTROL_DISABLE;
+
+		if (!SetCommState(mCom, &dcb))
+		{
+			return false;
+		}
+
+		// whatever arrived while switching is garbage
+		PurgeComm(mCom, PURGE_RXCLEAR);
+
+		return true;
+	}
+
+	bool ReadLine(std::string_view* line)
 	{
 		while (!WaitExitOrTimeout(0ms))
 		{
-			Utf8String str;
-			if (CanReadLine(&str))
+			if (CanReadLine(line))
 			{
-				line->assign(str);
 				return true;
 			}
 
+			std::uint32_t size;
+			auto buffer = PrepareRead(&size);
+
 			DWORD read;
 			OVERLAPPED op = { 0 };
 			op.hEvent = mReadReset;
-			if (!ReadFile(mCom, mReadBuffer, mReadBufferNum, &read, &op))
+			if (!ReadFile(mCom, buffer, size, &read, &op))
 			{
 				if (GetLastError() != ERROR_IO_PENDING)
 				{
 					return false;
 				}
 
-				if (!this->WaitCancelOverlapped(mReadReset))
+				if (!this->WaitCancelOverlapped(&op))
 				{
 					return false;
 				}
@@ -194,7 +246,7 @@ public:
 				}
 			}
 
-			mReadLineBuffer.append(mReadBuffer, read);
+			CommitRead(read);
 		}
 
 		return false;
@@ -245,6 +297,144 @@ bool GetCommDevice(const std::filesystem::path& root, const PlatformString& port
 	return false;
 }
 
+class PlatformMappedFileWindows :public PlatformMappedFile
+{
+private:
+	SafeHANDLE mFile;
+	SafeHANDLE mMapping;
+	byte* mData;
+	size_t mSize;
+public:
+	PlatformMappedFileWindows(const SafeHANDLE& file, const SafeHANDLE& mapping, byte* data, size_t size) :PlatformMappedFile()
+	{
+		mFile = file;
+		mMapping = mapping;
+		mData = data;
+		mSize = size;
+	}
+
+	~PlatformMappedFileWindows()
+	{
+		UnmapViewOfFile(mData);
+	}
+
+	byte* GetData()
+	{
+		return mData;
+	}
+
+	size_t GetSize() const
+	{
+		return mSize;
+	}
+
+	bool Flush(size_t offset, size_t size)
+	{
+		// FlushViewOfFile only hands the pages to the cache manager
+		return FlushViewOfFile(mData + offset, size) && FlushFileBuffers(mFile);
+	}
+};
+
+SafeFdPtr OpenLogFile(const std::filesystem::path& path)
+{
+	return SafeFdPtr(_wopen(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE));
+}
+
+std::shared_ptr<PlatformMappedFile> OpenMappedFile(const std::filesystem::path& path, size_t size)
+{
+	SafeHANDLE file = SafeHANDLE(CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL));
+
+	LARGE_INTEGER current = { 0 };
+
+	if (!file || !GetFileSizeEx(file, &current))
+	{
+		return std::shared_ptr<PlatformMappedFile>();
+	}
+
+	if ((size_t)current.QuadPart < size)
+	{
+		LARGE_INTEGER end = { 0 };
+		end.QuadPart = size;
+
+		if (!SetFilePointerEx(file, end, NULL, FILE_BEGIN) || !SetEndOfFile(file) || !FlushFileBuffers(file))
+		{
+			return std::shared_ptr<PlatformMappedFile>();
+		}
+	}
+	else
+	{
+		size = (size_t)current.QuadPart;
+	}
+
+	ULARGE_INTEGER mapped = { 0 };
+	mapped.QuadPart = size;
+
+	SafeHANDLE mapping = SafeHANDLE(CreateFileMappingW(file, NULL, PAGE_READWRITE, mapped.HighPart, mapped.LowPart, NULL));
+
+	if (!mapping)
+	{
+		return std::shared_ptr<PlatformMappedFile>();
+	}
+
+	auto data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+
+	if (data == NULL)
+	{
+		return std::shared_ptr<PlatformMappedFile>();
+	}
+
+	return std::make_shared<PlatformMappedFileWindows>(file, mapping, (byte*)data, size);
+}
+
+bool StartModemReactor(size_t threads)
+{
+	// not implemented, every device runs on its own thread
+	return false;
+}
+
+bool AttachModemReactor(const std::filesystem::path& root, const PlatformString& port)
+{
+	return false;
+}
+
+void StopModemReactor()
+{
+	// nothing
+}
+
+bool StartHotplugMonitor()
+{
+	// not implemented, devices are found by the timer
+	return false;
+}
+
+void StopHotplugMonitor()
+{
+	// nothing
+}
+
+bool StartMetricsServer(const Utf8String&, std::uint16_t)
+{
+	// not implemented
+	return false;
+}
+
+void StopMetricsServer()
+{
+	// nothing
+}
+
+bool StartMailSink(std::uint16_t, const MailSinkOptions&, Utf8String*)
+{
+	// not implemented
+	return false;
+}
+
+void StopMailSink()
+{
+	// nothing
+}
+
 BOOL WINAPI CtrlHandler(DWORD fdwCtrlType)
 {
 	switch (fdwCtrlType)
@@ -255,6 +445,12 @@ BOOL WINAPI CtrlHandler(DWORD fdwCtrlType)
 	case CTRL_LOGOFF_EVENT:
 	case CTRL_SHUTDOWN_EVENT:
 		PLATFORMCOUT << PLATFORMSTR("Received closing event...") << std::endl;
+
+		if (ExitHandle)
+		{
+			SetEvent(ExitHandle);
+		}
+
 		ExitReset.Set();
 		return TRUE;
 	default: